@@ -28,69 +28,243 @@
 #include <linux/types.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
+#include <linux/notifier.h>
+#include <linux/parser.h>
+#include <linux/if_arp.h>
+#include <linux/rtnetlink.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/log2.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/types.h>
+#endif
+#include <linux/nodemask.h>
+#include <linux/cpumask.h>
+#include <linux/jhash.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/ieee80211.h>
+#include <net/ieee80211_radiotap.h>
+#include <asm/unaligned.h>
 
 #include "filter.h"
+#include "listener.h"
 #include "device.h"
 
 //*****************************************************************************
 // Type definitions
 //*****************************************************************************
 
+#define RTAP_DEVICE_BURST_BUCKETS 11 // 1 .. 1024+
+#define RTAP_DEVICE_LAT_SUB       2 // Log2 of sub-buckets per power of two
+#define RTAP_DEVICE_LAT_BUCKETS   (32 << RTAP_DEVICE_LAT_SUB) // 0 .. ~4s in ns
+#define RTAP_DEVICE_RTHDR_MAX     256 // Radiotap bytes copied from paged frames
+#define RTAP_DEVICE_RTWORDS       4 // Present words a cached layout may span
+#define RTAP_DEVICE_RTLAYOUTS     8 // Cached radiotap layouts per device
+#define RTAP_DEVICE_RTFIELDS      (BIT(IEEE80211_RADIOTAP_TSFT) | BIT(IEEE80211_RADIOTAP_FLAGS) | \
+    BIT(IEEE80211_RADIOTAP_RATE) | BIT(IEEE80211_RADIOTAP_CHANNEL) | \
+    BIT(IEEE80211_RADIOTAP_DBM_ANTSIGNAL) | BIT(IEEE80211_RADIOTAP_DBM_ANTNOISE) | \
+    BIT(IEEE80211_RADIOTAP_MCS) | BIT(IEEE80211_RADIOTAP_VHT))
+
+// Where received frames are run through the filters
+typedef enum rtap_device_mode
+{
+  RTAP_DEVICE_MODE_WORKER = 0, // Queued to a worker thread
+  RTAP_DEVICE_MODE_INLINE = 1, // In softirq; sends that would block go to a worker
+  RTAP_DEVICE_MODE_WQ = 2, // Queued to a worker run on the shared workqueue
+  RTAP_DEVICE_MODE_LAST
+} rtap_device_mode_t;
+
+// Where a worker spends its time
+typedef enum rtap_device_wstate
+{
+  RTAP_DEVICE_WSTATE_BUSY = 0, // Draining rings
+  RTAP_DEVICE_WSTATE_POLL = 1, // Spinning on empty rings
+  RTAP_DEVICE_WSTATE_SLEEP = 2, // Waiting for a producer wakeup
+  RTAP_DEVICE_WSTATE_LAST
+} rtap_device_wstate_t;
+
+// Admission classes keyed on 802.11 frame control type
+typedef enum rtap_device_class
+{
+  RTAP_DEVICE_CLASS_MGMT = 0,
+  RTAP_DEVICE_CLASS_CTRL = 1,
+  RTAP_DEVICE_CLASS_DATA = 2, // Also anything that cannot be parsed
+  RTAP_DEVICE_CLASS_LAST
+} rtap_device_class_t;
+
+// How the device is hooked into the receive path
+typedef enum rtap_device_attach
+{
+  RTAP_DEVICE_ATTACH_PTYPE = 0, // ETH_P_ALL tap; sees a shared reference
+  RTAP_DEVICE_ATTACH_RXH = 1, // rx_handler; monitor interfaces only
+  RTAP_DEVICE_ATTACH_LAST
+} rtap_device_attach_t;
+
+struct rtap_device;
+
+struct rtap_device_rxent
+{
+  struct sk_buff* skb;
+  struct rtap_listener* l; // Set for a deferred inline send; skips filters
+  struct rtap_device_pending* pend; // Shared by the deferred sends of a frame
+  u64 pkts;
+  u64 bytes;
+  u64 rxtime;
+  u8 cls;
+};
+
+// Receive counters; one copy per CPU, folded only when read through proc
+struct rtap_device_stats
+{
+  u64 pkts;
+  u64 bytes;
+  struct u64_stats_sync syncp;
+};
+
+// Tracks a frame whose sends were split between softirq and a worker, so
+// its latency is recorded once, when the last of them completes
+struct rtap_device_pending
+{
+  atomic_t refs; // Frame's own pass plus one per deferred send
+  bool sent; // Any send of the frame reached its listener
+};
+
+// Capture-to-wire latency of forwarded frames, recorded once per frame when
+// its last send completes; one copy per CPU
+struct rtap_device_lat
+{
+  u32 deferred; // Inline sends handed to a worker because they would block
+  u32 hist[RTAP_DEVICE_LAT_BUCKETS];
+};
+
+// Single-producer/single-consumer ring; one per CPU per worker. The producer
+// is rtap_device_recv() running on the owning CPU, the consumer is the worker.
+// Per-class occupancy is enq[] - deq[], each side owning its own counters.
+struct rtap_device_ring
+{
+  u32 head; // Written by producer only
+  u32 mask;
+  u32 enq[RTAP_DEVICE_CLASS_LAST];
+  u32 drops[RTAP_DEVICE_CLASS_LAST]; // Frames refused on this CPU per class
+  u32 highwater; // Highest occupancy seen by the producer
+  struct rtap_device_rxent* ent;
+  u32 tail ____cacheline_aligned_in_smp; // Written by consumer only
+  u32 deq[RTAP_DEVICE_CLASS_LAST];
+};
+
+struct rtap_device_worker
+{
+  struct rtap_device* dev;
+  struct task_struct* task; // NULL when run from the shared workqueue
+  struct work_struct work;
+  struct rtap_device_ring __percpu* rings;
+  bool idle;
+  u32 id;
+  int cpu_next; // Last ring visited; next burst starts after it
+  u32 frames; // Frames processed by this worker
+  u32 bursts[RTAP_DEVICE_BURST_BUCKETS]; // Log2 histogram of burst sizes
+  bool polling; // Spin on empty rings instead of sleeping straight away
+  u32 switches; // Transitions between sleeping and polling behaviour
+  u64 win_start; // Arrival rate sampling window
+  u32 win_frames;
+  u64 ns[RTAP_DEVICE_WSTATE_LAST];
+};
+
+struct rtap_device_opts
+{
+  u32 ring_depth;
+  u32 nworkers;
+  u32 budget;
+  u32 poll_us;
+  u32 poll_rate;
+  bool prefilter;
+  rtap_device_mode_t mode;
+  bool consume;
+  rtap_device_attach_t attach;
+  bool reserve_set;
+  u32 reserve[RTAP_DEVICE_CLASS_LAST];
+  int node;
+  int policy;
+  int prio;
+  cpumask_var_t cpus; // Must stay last; see rtap_device_opts_copy()
+};
+
+// Wildcard interface name; matching interfaces are attached as they appear
+struct rtap_device_pattern
+{
+  struct list_head list;
+  char name[IFNAMSIZ];
+  struct rtap_device_opts opts;
+};
+
 struct rtap_device
 {
-    struct list_head list;
+    struct list_head list; // RCU protected; updated under RTNL
     spinlock_t lock;
     struct packet_type pt;
-    struct kthread_worker kworker;
-    struct task_struct* kworker_task;
-    u8 wrk_count;
-    u8 wrk_highwater;
-    u16 wrk_drop;
-    u32 pkts;
-    u32 bytes;
+    struct rtap_device_pattern* pat; // Pattern the interface was attached by
+    struct rtap_device_worker* workers;
+    u32 nworkers;
+    cpumask_var_t cpus;
+    int node; // NUMA node for workers and their rings; NUMA_NO_NODE if unset
+    int policy; // Worker scheduling policy: SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+    int prio; // Real-time priority, or nice level for SCHED_NORMAL
+    u32 ring_depth;
+    u32 budget; // Frames per worker burst
+    u32 poll_us; // Spin budget once rings run empty; 0 disables polling
+    u32 poll_rate; // Arrival rate in frames/s above which workers poll
+    u32 reserve[RTAP_DEVICE_CLASS_LAST]; // Ring slots guaranteed per class
+    u32 shared; // Ring slots any class may use beyond its reservation
+    bool prefilter; // Reject frames no filter can match before queueing
+    rtap_device_attach_t attach;
+    bool consume; // rx_handler only: frames stop at rtap
+    rtap_device_mode_t mode;
+    struct rtap_device_lat __percpu* lat;
+    u32 __percpu* prefiltered;
+    struct rtap_device_stats __percpu* stats;
+    struct rtap_device_rtcache __rcu* rtcache; // Radiotap layouts seen; updated under 'lock'
 };
 
-struct rtap_device_kwork
+// Where the fields rtap extracts sit for one sequence of present words. The
+// layout only depends on those words unless a vendor namespace is present.
+struct rtap_device_rtlayout
 {
-  struct kthread_work kwork;
-  struct net_device *dev;
-  struct packet_type *pt;
-  struct sk_buff* skb;
-  u32 pkts;
-  u32 bytes;
+    u32 present[RTAP_DEVICE_RTWORDS]; // Unused words are zero
+    u32 have; // BIT(IEEE80211_RADIOTAP_*) of the fields located
+    u16 rtlen_min; // Header bytes needed to hold them
+    u16 off[IEEE80211_RADIOTAP_VHT + 1];
 };
 
-struct rtap_device_skbmeta
-{
-  u32 magic; // 'RTAP'
-  u8 ver; // Metadata header version; currently 0x01
-  u8 hdrlen; // Metadata header length; currently 0x20
-  u8 ethaddr[ETH_ALEN]; // Listening device address
-  u32 pktid; // Cumulative packet count
-  u32 len; // Packet length including metadata header
-  u32 bytecnt; // Cumulative byte count as seen by listening device
-  u32 secs; // Time packet was received by listening device
-  u32 nsecs;
+// Replaced as a whole when a layout is added
+struct rtap_device_rtcache
+{
+    struct rcu_head rcu;
+    u32 nlayouts;
+    struct rtap_device_rtlayout layouts[];
 };
 
 #define to_rtap_device(p,e)  ((container_of((p), struct rtap_device, e)))
-#define to_rtap_device_kwork(p,e)  ((container_of((p), struct rtap_device_kwork, e)))
 
 #define RTAP_MAGIC              0x52544150 // 'RTAP'
-#define RTAP_VER                0x01 // 0.1
-#define RTAP_DEVICE_KWORK_MAX   0x10
-
-struct rtap_device_kwork_tbl
-{
-  spinlock_t lock;
-  u32 freelist_index;
-  struct rtap_device_kwork* freelist[RTAP_DEVICE_KWORK_MAX];
-  struct rtap_device_kwork data[RTAP_DEVICE_KWORK_MAX];
-};
+#define RTAP_VER                0x02 // 0.2
+#define RTAP_DEVICE_RING_MIN    0x10
+#define RTAP_DEVICE_RING_DEF    0x100
+#define RTAP_DEVICE_RING_MAX    0x4000
+#define RTAP_DEVICE_WORKER_MAX  0x20
+#define RTAP_DEVICE_BUDGET_DEF  0x40
+#define RTAP_DEVICE_BUDGET_MAX  0x400
+#define RTAP_DEVICE_POLL_MAX    1000 // usecs
+#define RTAP_DEVICE_POLL_RATE   10000 // frames/s
+#define RTAP_DEVICE_POLL_WINDOW (10 * NSEC_PER_MSEC)
 
 //*****************************************************************************
 // Variables
@@ -100,16 +274,37 @@ struct rtap_device_kwork_tbl
 
 /* Local */
 
-static struct rtap_device rtap_devices = { { 0 } };
-static struct rtap_device_kwork_tbl rtap_kwork_tbl;
+static struct rtap_device rtap_devices = { { 0 } }; // RCU protected
+static const char* rtap_device_class_str[RTAP_DEVICE_CLASS_LAST] =
+{
+    [RTAP_DEVICE_CLASS_MGMT] = "mgmt",
+    [RTAP_DEVICE_CLASS_CTRL] = "ctrl",
+    [RTAP_DEVICE_CLASS_DATA] = "data",
+};
+static const char* rtap_device_attach_str[RTAP_DEVICE_ATTACH_LAST] =
+{
+    [RTAP_DEVICE_ATTACH_PTYPE] = "ptype",
+    [RTAP_DEVICE_ATTACH_RXH] = "rxhandler",
+};
+static const char* rtap_device_mode_str[RTAP_DEVICE_MODE_LAST] =
+{
+    [RTAP_DEVICE_MODE_WORKER] = "worker",
+    [RTAP_DEVICE_MODE_INLINE] = "inline",
+    [RTAP_DEVICE_MODE_WQ] = "wq",
+};
+static struct workqueue_struct* rtap_device_wq = NULL; // Shared by wq mode devices
+static const char* rtap_device_wstate_str[RTAP_DEVICE_WSTATE_LAST] =
+{
+    [RTAP_DEVICE_WSTATE_BUSY] = "busy",
+    [RTAP_DEVICE_WSTATE_POLL] = "poll",
+    [RTAP_DEVICE_WSTATE_SLEEP] = "sleep",
+};
+static LIST_HEAD(rtap_device_patterns); // RTNL protected
 
 //*****************************************************************************
 // Local Functions
 //*****************************************************************************
 
-static struct rtap_device*
-rtap_device_findbyname(const char* devname);
-
 /******************************************************************************
  *
  ******************************************************************************/
@@ -118,7 +313,7 @@ rtap_device_findbyname(const char* devname);
 /******************************************************************************
  *
  ******************************************************************************/
-static void
+static void __maybe_unused
 skb_display(struct sk_buff* skb)
 {
   if (skb)
@@ -155,387 +350,1974 @@ skb_display(struct sk_buff* skb)
 /******************************************************************************
  *
  ******************************************************************************/
-static struct net_device *
-get_devbyname(const char *devname)
+static bool
+rtap_device_ring_admit(struct rtap_device* d, struct rtap_device_ring* r,
+    rtap_device_class_t cls)
 {
+  u32 shared_used = 0;
+  int c;
 
-  struct net_device *netdev = first_net_device(&init_net);
-  while (netdev)
+  // A class below its reservation is always admitted; the reservations and
+  // the shared pool add up to the ring depth so there is room for it
+  if ((r->enq[cls] - READ_ONCE(r->deq[cls])) < d->reserve[cls])
   {
-    if (!strcmp(netdev->name, devname))
-    {
-      printk( KERN_INFO "RTAP: Found device: %s\n", netdev->name);
-      break;
-    } // end if
-    netdev = next_net_device(netdev);
-  } // end while
+    return (true);
+  }
 
-  return (netdev);
+  // Otherwise it competes for whatever is left of the shared pool
+  for (c = 0; c < RTAP_DEVICE_CLASS_LAST; c++)
+  {
+    u32 occ = r->enq[c] - READ_ONCE(r->deq[c]);
+    if (occ > d->reserve[c])
+    {
+      shared_used += occ - d->reserve[c];
+    }
+  } // end loop
 
+  return (shared_used < d->shared);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static struct rtap_device_kwork*
-rtap_device_kwork_alloc(void)
+static void
+rtap_device_worker_kick(struct rtap_device_worker* w)
 {
-  struct rtap_device_kwork* wrk = NULL;
-
-  spin_lock(&rtap_kwork_tbl.lock);
-  if (rtap_kwork_tbl.freelist_index)
+  if (w->task)
   {
-    rtap_kwork_tbl.freelist_index--;
-    //  printk( KERN_INFO "RTAP: Allocating kwork: %u\n", rtap_kwork_tbl.freelist_index);
-    wrk = rtap_kwork_tbl.freelist[rtap_kwork_tbl.freelist_index];
-    rtap_kwork_tbl.freelist[rtap_kwork_tbl.freelist_index] = NULL;
+    wake_up_process(w->task);
+  }
+  else
+  {
+    queue_work(rtap_device_wq, &w->work);
   }
-  spin_unlock(&rtap_kwork_tbl.lock);
-
-  return(wrk);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static void
-rtap_device_kwork_free(struct rtap_device_kwork* wrk)
+static int
+rtap_device_ring_put(struct rtap_device_worker* w, const struct rtap_device_rxent* ent)
 {
-  if (wrk)
+  struct rtap_device* d = w->dev;
+  struct rtap_device_ring* r = NULL;
+  u32 head = 0;
+  u32 used = 0;
+  int ret = -1;
+
+  // Keep the ring owned by this CPU for the duration of the enqueue
+  local_bh_disable();
+  r = this_cpu_ptr(w->rings);
+  head = r->head;
+  used = head - smp_load_acquire(&r->tail);
+  if ((used <= r->mask) && rtap_device_ring_admit(d, r, ent->cls))
+  {
+    r->ent[head & r->mask] = *ent;
+    r->enq[ent->cls]++;
+    smp_store_release(&r->head, head + 1);
+    if (used >= r->highwater)
+    {
+      r->highwater = used + 1;
+    }
+    ret = 0;
+  }
+  else
   {
-    // Return work back to free list
-    spin_lock(&rtap_kwork_tbl.lock);
-//    printk( KERN_INFO "RTAP: Freeing kwork: %u\n", rtap_kwork_tbl.freelist_index);
-    rtap_kwork_tbl.freelist[rtap_kwork_tbl.freelist_index] = wrk;
-    rtap_kwork_tbl.freelist_index++;
-    spin_unlock(&rtap_kwork_tbl.lock);
+    r->drops[ent->cls]++;
   }
+  local_bh_enable();
+
+  // Wake worker only if it has announced that it is going to sleep
+  if (!ret)
+  {
+    smp_mb();
+    if (READ_ONCE(w->idle))
+    {
+      rtap_device_worker_kick(w);
+    }
+  }
+
+  return (ret);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static void
-rtap_device_rx_worker(struct kthread_work* work)
+static bool
+rtap_device_ring_pending(struct rtap_device_worker* w)
 {
-
-  if (work)
+  int cpu;
+  for_each_possible_cpu(cpu)
   {
-    struct sk_buff* nskb = NULL;
-    struct rtap_device_skbmeta* skbmeta = NULL;
-    struct timespec ts = { 0 };
-    struct rtap_device_kwork* wrk = NULL;
-    wrk = to_rtap_device_kwork(work, kwork);
-
-//    printk( KERN_INFO "RTAP:\n");
-//    printk( KERN_INFO "RTAP: Received packet on device: %s\n", wrk->dev->name);
-//    skb_display(wrk->skb);
-
-    // Convert sk_buff ktime_t timestamp
-    ts = ktime_to_timespec(wrk->skb->tstamp);
-
-    // Create copy of socket buffer while adding headroom for metadata
-    nskb = skb_copy_expand(wrk->skb, sizeof(struct rtap_device_skbmeta), 0, GFP_ATOMIC);
-    skbmeta = (struct rtap_device_skbmeta* )skb_push(nskb, sizeof(struct rtap_device_skbmeta));
-
-    // Populate metadata header
-    skbmeta->magic = cpu_to_be32(RTAP_MAGIC);
-    skbmeta->ver = RTAP_VER;
-    skbmeta->hdrlen = sizeof(struct rtap_device_skbmeta);
-    memcpy(&skbmeta->ethaddr, &wrk->dev->perm_addr, ETH_ALEN);
-    skbmeta->pktid = cpu_to_be32(wrk->pkts);
-    skbmeta->len = cpu_to_be32(nskb->len);
-    skbmeta->bytecnt = cpu_to_be32(wrk->bytes);
-    skbmeta->secs = cpu_to_be32(ts.tv_sec);
-    skbmeta->nsecs = cpu_to_be32(ts.tv_nsec);
-
-    if (nskb->next || nskb->prev || nskb->data_len)
+    struct rtap_device_ring* r = per_cpu_ptr(w->rings, cpu);
+    if (READ_ONCE(r->head) != r->tail)
     {
-      // Flag this as a possible loss of packet data
-      printk( KERN_WARNING "RTAP: Possible data loss");
-      skb_display(nskb);
+      return (true);
     }
-
-    // Forward packet to filter
-    rtap_filter_recv(nskb);
-
-    // Free frame
-    kfree_skb(nskb);
-    kfree_skb(wrk->skb);
-
-    // Return work structure back to free list
-    rtap_device_kwork_free(wrk);
-
   }
-
-  return;
+  return (false);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static int
-rtap_device_recv(struct sk_buff *skb, struct net_device *dev,
-    struct packet_type *pt, struct net_device *orig_dev)
+static u32
+rtap_device_lat_bucket(u64 ns)
 {
+  u32 lg = 0;
 
-  int ret = 0;
-  struct rtap_device* d = rtap_device_findbyname(dev->name);
-
-  if (d)
+  // Log2 buckets, each split linearly into 1 << RTAP_DEVICE_LAT_SUB parts
+  if (ns < (1 << RTAP_DEVICE_LAT_SUB))
   {
-    struct rtap_device_kwork* wrk = rtap_device_kwork_alloc();
-
-    // Lock device list
-    spin_lock(&rtap_devices.lock);
-
-    if (wrk)
-    {
-      // Initialize work structure
-      memset((void *) wrk, 0, sizeof(struct rtap_device_kwork));
-
-      // Update device pkt counters
-      d->pkts++;
-      d->bytes += skb->len;
+    return ((u32) ns);
+  }
+  lg = ilog2(ns);
+  return (min_t(u32, ((lg - RTAP_DEVICE_LAT_SUB + 1) << RTAP_DEVICE_LAT_SUB) |
+      ((ns >> (lg - RTAP_DEVICE_LAT_SUB)) & ((1 << RTAP_DEVICE_LAT_SUB) - 1)),
+      RTAP_DEVICE_LAT_BUCKETS - 1));
+}
 
-      // Initialize work structure
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,9,0)
-      init_kthread_work(&wrk->kwork, rtap_device_rx_worker);
-#else
-      kthread_init_work(&wrk->kwork, rtap_device_rx_worker);
-#endif
-      wrk->dev = dev;
-      wrk->pt = pt;
-      wrk->skb = skb;
-      wrk->pkts = d->pkts;
-      wrk->bytes = d->bytes;
-
-      // Queue work
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,9,0)
-      queue_kthread_work(&d->kworker, &wrk->kwork);
-#else
-      kthread_queue_work(&d->kworker, &wrk->kwork);
-#endif
-    }
-    else
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_pend_put(struct rtap_device* d, struct rtap_device_pending* p, u64 rxtime)
+{
+  if (atomic_dec_and_test(&p->refs))
+  {
+    if (READ_ONCE(p->sent))
     {
-      ret = -1;
-      d->wrk_drop++;
+      this_cpu_inc(d->lat->hist[rtap_device_lat_bucket(ktime_get_ns() - rxtime)]);
     }
-
-    // Unlock device list
-    spin_unlock(&rtap_devices.lock);
-  }
-  else
-  {
-    printk( KERN_WARNING "RTAP: Cannot find device: %s\n", dev->name);
-    ret = -1;
+    kfree(p);
   }
-
-  // Return success
-  return (ret);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static int
-rtap_device_remove(const char *devname)
+static void
+rtap_device_rx_process(struct rtap_device* d, struct rtap_device_rxent* e,
+    int cpu, unsigned int sendflags)
 {
-  struct rtap_device *dev = 0;
-  struct rtap_device *tmp = 0;
-  int ret = -1;
+  struct rtap_frame frame = { 0 };
+
+//  printk( KERN_INFO "RTAP:\n");
+//  printk( KERN_INFO "RTAP: Received packet on device: %s\n", d->pt.dev->name);
+//  skb_display(e->skb);
+
+  // Filters run against the original frame; nothing is copied here
+  frame.skb = e->skb;
+  frame.dev = d->pt.dev;
+  frame.owner = d;
+  frame.sendflags = sendflags;
+  frame.rxtime = e->rxtime;
+  frame.cpu = cpu;
+  frame.pkts = e->pkts;
+  frame.bytes = e->bytes;
+
+  // Finish a send deferred from softirq, or forward packet to filter
+  if (e->l)
+  {
+    listener_send(e->l, &frame);
+    listener_put(e->l);
+  }
+  else
+  {
+    rtap_filter_recv(&frame);
+  }
 
-  // Search for device in list and remove
-  spin_lock(&rtap_devices.lock);
-  list_for_each_entry_safe(dev, tmp, &rtap_devices.list, list)
+  // Record latency once per frame, when its last send has completed
+  if (e->pend || frame.pending)
   {
-    if( ! strcmp( dev->pt.dev->name, devname ) )
+    struct rtap_device_pending* p = (e->pend ? e->pend : frame.pending);
+    if (frame.sent)
     {
-      printk( KERN_INFO "RTAP: Removing device: %s\n", dev->pt.dev->name );
-      dev_remove_pack( &dev->pt );
-      list_del( &dev->list );
-      kthread_stop(dev->kworker_task);
-      kfree( dev );
-      ret = 0;
-      break;
-    } // end if
-  } // end loop
-  spin_unlock(&rtap_devices.lock);
+      WRITE_ONCE(p->sent, true);
+    }
+    rtap_device_pend_put(d, p, e->rxtime);
+  }
+  else if (frame.sent)
+  {
+    this_cpu_inc(d->lat->hist[rtap_device_lat_bucket(ktime_get_ns() - e->rxtime)]);
+  }
 
-  // Return non-null network device pointer on success; null on error
-  return (ret);
+  return;
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static struct net_device *
-rtap_device_add(const char *devname)
+static int
+rtap_device_rx_drain(struct rtap_device_worker* w, u32 budget)
 {
-  struct rtap_device *dev = 0;
-  struct net_device *netdev = 0;
-
-  // First remove any existing devices with same name
-  rtap_device_remove(devname);
-
-  // Lookup network device by given name
-  netdev = get_devbyname(devname);
-  if (!netdev)
-  {
-    printk( KERN_ERR "RTAP: Device '%s' not found\n", devname);
-    return (0);
-  } // end if
-
-  // Allocate new device list item
-  dev = kmalloc(sizeof(struct rtap_device), GFP_ATOMIC);
-  if (!dev)
+  struct sk_buff* freelist = NULL;
+  struct sk_buff* next = NULL;
+  int cpu = w->cpu_next;
+  u32 cnt = 0;
+  u32 n = 0;
+
+  // Visit every CPU ring once, starting where the last burst stopped
+  for (n = 0; (n < num_possible_cpus()) && (cnt < budget); n++)
   {
-    printk( KERN_CRIT "RTAP: Cannot allocate memory: dev[%s]\n", devname);
-    return (0);
-  } // end if
-  memset((void *) dev, 0, sizeof(struct rtap_device));
+    struct rtap_device_ring* r = NULL;
+    u32 tail = 0;
+    u32 head = 0;
 
-  // Populate device list item
-  dev->pt.dev = netdev;
-  dev->pt.type = htons(ETH_P_ALL);
-  dev->pt.func = rtap_device_recv;
+    cpu = cpumask_next(cpu, cpu_possible_mask);
+    if (cpu >= nr_cpu_ids)
+    {
+      cpu = cpumask_first(cpu_possible_mask);
+    }
+    r = per_cpu_ptr(w->rings, cpu);
+    tail = r->tail;
+    head = smp_load_acquire(&r->head);
 
-  // Initialize workers
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,9,0)
-  init_kthread_worker(&dev->kworker);
+    while ((tail != head) && (cnt < budget))
+    {
+      // Copy entry out and release the slot before processing
+      struct rtap_device_rxent e = r->ent[tail & r->mask];
+      WRITE_ONCE(r->deq[e.cls], r->deq[e.cls] + 1);
+      smp_store_release(&r->tail, ++tail);
+      rtap_device_rx_process(w->dev, &e, cpu, 0);
+
+      // Collect frames we hold the last reference to and free them in bulk;
+      // shared frames are only unreferenced, their 'next' is not ours
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,13,0)
+      kfree_skb(e.skb);
 #else
-  kthread_init_worker(&dev->kworker);
+      if (skb_unref(e.skb))
+      {
+        e.skb->next = freelist;
+        freelist = e.skb;
+      }
 #endif
-  dev->kworker_task = kthread_run(kthread_worker_fn, &dev->kworker, "rtap-%s", devname);
+      cnt++;
+    } // end while
+  } // end loop
+  w->cpu_next = cpu;
 
-  // Add device list item to tail of device list
-  spin_lock(&rtap_devices.lock);
-  list_add_tail(&dev->list, &rtap_devices.list);
-  spin_unlock(&rtap_devices.lock);
+  // References were already dropped above, so free without another unref
+  while (freelist)
+  {
+    next = freelist->next;
+    __kfree_skb(freelist);
+    freelist = next;
+  } // end while
 
-  // Register for packet
-  dev_add_pack(&dev->pt);
+  if (cnt)
+  {
+    w->frames += cnt;
+    w->bursts[min_t(u32, ilog2(cnt), RTAP_DEVICE_BURST_BUCKETS - 1)]++;
+  }
 
-  printk( KERN_INFO "RTAP: Added device: %s\n", devname);
+  return (cnt);
+}
 
-  // Return non-null network device pointer on success; null on error
-  return (netdev);
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_rx_account(struct rtap_device_worker* w, rtap_device_wstate_t state,
+    u64* t)
+{
+  u64 now = ktime_get_ns();
+  w->ns[state] += now - *t;
+  *t = now;
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static int
-rtap_device_clear(void)
+static void
+rtap_device_rx_adapt(struct rtap_device_worker* w, u64 now)
 {
-  struct rtap_device *dev = NULL;
-  struct rtap_device *tmp = NULL;
+  struct rtap_device* d = w->dev;
+  u64 elapsed = now - w->win_start;
+  u64 rate = 0;
+  bool polling = false;
 
-  // Remove all devices from list
-  spin_lock(&rtap_devices.lock);
-  list_for_each_entry_safe(dev, tmp, &rtap_devices.list, list)
+  if (elapsed < RTAP_DEVICE_POLL_WINDOW)
   {
-    printk( KERN_INFO "RTAP: Removing device: %s\n", dev->pt.dev->name );
-    dev_remove_pack( &dev->pt );
-    list_del( &dev->list );
-    kthread_stop(dev->kworker_task);
-    kfree( dev );
-  } // end loop
-  spin_unlock(&rtap_devices.lock);
+    return;
+  }
 
-  return (0);
+  // Poll above the configured arrival rate, sleep again below half of it
+  rate = div64_u64((u64) w->win_frames * NSEC_PER_SEC, elapsed);
+  polling = (d->poll_us && (rate >= (w->polling ? (d->poll_rate / 2) : d->poll_rate)));
+  if (polling != w->polling)
+  {
+    w->polling = polling;
+    w->switches++;
+  }
+  w->win_start = now;
+  w->win_frames = 0;
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static struct rtap_device*
-rtap_device_findbyname(const char* devname)
+static bool
+rtap_device_rx_poll(struct rtap_device_worker* w)
 {
-  struct rtap_device* dev = NULL;
-  struct rtap_device *d = NULL;
+  u64 end = ktime_get_ns() + ((u64) w->dev->poll_us * NSEC_PER_USEC);
 
-  spin_lock(&rtap_devices.lock);
-  list_for_each_entry(d, &rtap_devices.list, list)
+  // Producers do not wake a worker that is not idle, so this saves wakeups
+  do
   {
-    if(! (strcmp(d->pt.dev->name, devname)) )
+    if (rtap_device_ring_pending(w))
     {
-      dev = d;
-      break;
+      return (true);
     }
-  } // end loop
-  spin_unlock(&rtap_devices.lock);
+    cpu_relax();
+  } while (!need_resched() && !kthread_should_stop() && (ktime_get_ns() < end));
 
-  return(dev);
+  return (false);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-int
-rtap_device_init(void)
+static int
+rtap_device_rx_thread(void* arg)
 {
-  int i;
-  spin_lock_init(&rtap_devices.lock);
-  INIT_LIST_HEAD(&rtap_devices.list);
-  spin_lock_init(&rtap_kwork_tbl.lock);
-  rtap_kwork_tbl.freelist_index = 0;
-  for (i = 0; i < RTAP_DEVICE_KWORK_MAX; i++)
+  struct rtap_device_worker* w = (struct rtap_device_worker*) arg;
+  u64 t = ktime_get_ns();
+  u32 cnt = 0;
+
+  w->win_start = t;
+  while (!kthread_should_stop())
   {
-    rtap_kwork_tbl.freelist[i] = &rtap_kwork_tbl.data[i];
-    rtap_kwork_tbl.freelist_index++;
-  }
+    cnt = rtap_device_rx_drain(w, w->dev->budget);
+    rtap_device_rx_account(w, RTAP_DEVICE_WSTATE_BUSY, &t);
+    w->win_frames += cnt;
+    rtap_device_rx_adapt(w, t);
+    if (cnt)
+    {
+      // More may be pending; give others a chance between bursts
+      cond_resched();
+    }
+    else if (w->polling && rtap_device_rx_poll(w))
+    {
+      // Work arrived while spinning
+      rtap_device_rx_account(w, RTAP_DEVICE_WSTATE_POLL, &t);
+    }
+    else
+    {
+      if (w->polling)
+      {
+        rtap_device_rx_account(w, RTAP_DEVICE_WSTATE_POLL, &t);
+      }
+
+      // Announce idle before the final check so producers know to wake us
+      WRITE_ONCE(w->idle, true);
+      set_current_state(TASK_INTERRUPTIBLE);
+      if (!rtap_device_ring_pending(w) && !kthread_should_stop())
+      {
+        schedule();
+      }
+      __set_current_state(TASK_RUNNING);
+      WRITE_ONCE(w->idle, false);
+      rtap_device_rx_account(w, RTAP_DEVICE_WSTATE_SLEEP, &t);
+    }
+  } // end while
+
   return (0);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-int
-rtap_device_exit(void)
+static void
+rtap_device_rx_work(struct work_struct* work)
 {
-  return (rtap_device_clear());
+  struct rtap_device_worker* w = container_of(work, struct rtap_device_worker, work);
+  u32 budget = w->dev->budget;
+
+  // A work item never runs concurrently with itself, which keeps the
+  // per-worker frame order of the kthread mode
+  WRITE_ONCE(w->idle, false);
+  if (rtap_device_rx_drain(w, budget) < budget)
+  {
+    // Announce idle before the final check so producers know to requeue us
+    WRITE_ONCE(w->idle, true);
+    smp_mb();
+    if (!rtap_device_ring_pending(w))
+    {
+      return;
+    }
+    WRITE_ONCE(w->idle, false);
+  }
+
+  // More pending; go to the back of the queue rather than hog the pool
+  queue_work(rtap_device_wq, &w->work);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static int
-proc_show(struct seq_file *file, void *arg)
+static void
+rtap_device_worker_stop(struct rtap_device_worker* w)
 {
-  struct rtap_device *dev = 0;
-  struct rtap_device *tmp = 0;
+  int cpu;
 
-  // Iterate over all devices in list
-  spin_lock(&rtap_devices.lock);
-  list_for_each_entry_safe(dev, tmp, &rtap_devices.list, list)
+  if (w->task)
   {
-    seq_printf( file, "dev[%s]\tpkts[%u]\tbytes[%u]\tdropped[%u]\n",
-        dev->pt.dev->name, dev->pkts, dev->bytes, dev->wrk_drop );
-  } // end loop
-  spin_unlock(&rtap_devices.lock);
+    kthread_stop(w->task);
+    w->task = NULL;
+  }
+  else if (w->dev && (w->dev->mode == RTAP_DEVICE_MODE_WQ))
+  {
+    // Also waits out a work item that keeps requeueing itself
+    cancel_work_sync(&w->work);
+  }
 
-  return (0);
+  if (w->rings)
+  {
+    // Release any frames left behind in the rings
+    for_each_possible_cpu(cpu)
+    {
+      struct rtap_device_ring* r = per_cpu_ptr(w->rings, cpu);
+      if (r->ent)
+      {
+        while (r->tail != r->head)
+        {
+          struct rtap_device_rxent* e = &r->ent[r->tail & r->mask];
+          kfree_skb(e->skb);
+          listener_put(e->l);
+          if (e->pend)
+          {
+            rtap_device_pend_put(w->dev, e->pend, e->rxtime);
+          }
+          r->tail++;
+        } // end while
+        kfree(r->ent);
+        r->ent = NULL;
+      }
+    } // end loop
+    free_percpu(w->rings);
+    w->rings = NULL;
+  }
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
 static int
-proc_open(struct inode *inode, struct file *file)
+rtap_device_worker_start(struct rtap_device* d, struct rtap_device_worker* w,
+    const char* devname, int bindcpu)
 {
-  return (single_open(file, proc_show, NULL));
-}
+  int cpu;
 
-/******************************************************************************
- *
- ******************************************************************************/
-static int
-proc_close(struct inode *inode, struct file *file)
-{
-  return (single_release(inode, file));
-}
+  w->dev = d;
+  INIT_WORK(&w->work, rtap_device_rx_work);
+  w->rings = alloc_percpu(struct rtap_device_ring);
+  if (!w->rings)
+  {
+    return (-ENOMEM);
+  }
+
+  // Allocate ring storage on the worker's node if one was given, otherwise
+  // local to the producing CPU
+  for_each_possible_cpu(cpu)
+  {
+    struct rtap_device_ring* r = per_cpu_ptr(w->rings, cpu);
+    r->mask = d->ring_depth - 1;
+    r->ent = kzalloc_node(d->ring_depth * sizeof(struct rtap_device_rxent),
+        GFP_KERNEL, ((d->node != NUMA_NO_NODE) ? d->node : cpu_to_node(cpu)));
+    if (!r->ent)
+    {
+      rtap_device_worker_stop(w);
+      return (-ENOMEM);
+    }
+  } // end loop
+
+  // Workqueue mode has no thread of its own; first frame queues the work
+  if (d->mode == RTAP_DEVICE_MODE_WQ)
+  {
+    w->idle = true;
+    return (0);
+  }
+
+  if (d->nworkers > 1)
+  {
+    w->task = kthread_create_on_node(rtap_device_rx_thread, w,
+        ((bindcpu >= 0) ? cpu_to_node(bindcpu) : d->node), "rtap-%s/%u", devname, w->id);
+  }
+  else
+  {
+    w->task = kthread_create_on_node(rtap_device_rx_thread, w,
+        ((bindcpu >= 0) ? cpu_to_node(bindcpu) : d->node), "rtap-%s", devname);
+  }
+  if (IS_ERR(w->task))
+  {
+    w->task = NULL;
+    rtap_device_worker_stop(w);
+    return (-ENOMEM);
+  }
+
+  // Pin worker when a CPU set was given; otherwise keep it on its node
+  if (bindcpu >= 0)
+  {
+    kthread_bind(w->task, bindcpu);
+  }
+  else if (d->node != NUMA_NO_NODE)
+  {
+    set_cpus_allowed_ptr(w->task, cpumask_of_node(d->node));
+  }
+
+  // Apply scheduling class before the worker first runs
+  if (d->policy != SCHED_NORMAL)
+  {
+    struct sched_param param = { .sched_priority = d->prio };
+    sched_setscheduler_nocheck(w->task, d->policy, &param);
+  }
+  else
+  {
+    set_user_nice(w->task, d->prio);
+  }
+  wake_up_process(w->task);
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_workers_stop(struct rtap_device* d)
+{
+  u32 i;
+
+  if (d->workers)
+  {
+    for (i = 0; i < d->nworkers; i++)
+    {
+      rtap_device_worker_stop(&d->workers[i]);
+    } // end loop
+    kfree(d->workers);
+    d->workers = NULL;
+  }
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_workers_start(struct rtap_device* d, const char* devname)
+{
+  int cpu = -1;
+  u32 i;
+
+  d->workers = kzalloc_node(d->nworkers * sizeof(struct rtap_device_worker),
+      GFP_KERNEL, d->node);
+  if (!d->workers)
+  {
+    return (-ENOMEM);
+  }
+
+  // Spread workers round-robin over the configured CPU set
+  for (i = 0; i < d->nworkers; i++)
+  {
+    if (!cpumask_empty(d->cpus))
+    {
+      cpu = cpumask_next_and(cpu, d->cpus, cpu_online_mask);
+      if (cpu >= nr_cpu_ids)
+      {
+        cpu = cpumask_first_and(d->cpus, cpu_online_mask);
+      }
+    }
+    d->workers[i].id = i;
+    if (rtap_device_worker_start(d, &d->workers[i], devname,
+        (cpu < nr_cpu_ids) ? cpu : -1))
+    {
+      rtap_device_workers_stop(d);
+      return (-ENOMEM);
+    }
+  } // end loop
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static const struct ieee80211_hdr*
+rtap_device_get_hdr(const struct sk_buff* skb, struct ieee80211_hdr* buf,
+    unsigned int* len)
+{
+  const struct ieee80211_radiotap_header* rthdr = NULL;
+  struct ieee80211_radiotap_header rtbuf;
+  u16 rtlen = 0;
+
+  // Locate 802.11 header behind the radiotap header and return up to 'len'
+  // bytes of it, copied into 'buf' only if the frame is paged at that point;
+  // 'len' is updated to what the frame actually holds
+  rthdr = skb_header_pointer(skb, 0, sizeof(rtbuf), &rtbuf);
+  if (!rthdr)
+  {
+    return (NULL);
+  }
+  rtlen = get_unaligned_le16(&rthdr->it_len);
+  if (skb->len < (rtlen + sizeof(buf->frame_control)))
+  {
+    return (NULL);
+  }
+  *len = min_t(unsigned int, *len, skb->len - rtlen);
+  return (skb_header_pointer(skb, rtlen, *len, buf));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static rtap_device_class_t
+rtap_device_classify(const struct ieee80211_hdr* hdr)
+{
+  rtap_device_class_t cls = RTAP_DEVICE_CLASS_DATA;
+  if (hdr)
+  {
+    if (ieee80211_is_mgmt(hdr->frame_control))
+    {
+      cls = RTAP_DEVICE_CLASS_MGMT;
+    }
+    else if (ieee80211_is_ctl(hdr->frame_control))
+    {
+      cls = RTAP_DEVICE_CLASS_CTRL;
+    }
+  }
+  return (cls);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static u32
+rtap_device_steer(struct rtap_device* d, const struct ieee80211_hdr* hdr,
+    unsigned int hdrlen)
+{
+  // Need the transmitter address
+  if ((d->nworkers == 1) || !hdr || (hdrlen < offsetof(struct ieee80211_hdr, addr3)))
+  {
+    return (0);
+  }
+
+  // ACK and CTS carry no transmitter address
+  if (ieee80211_is_ack(hdr->frame_control) || ieee80211_is_cts(hdr->frame_control))
+  {
+    return (0);
+  }
+
+  // Same transmitter always lands on the same worker to preserve its order
+  return (reciprocal_scale(jhash(hdr->addr2, ETH_ALEN, 0), d->nworkers));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_rx(struct rtap_device* d, struct sk_buff *skb)
+{
+
+  int ret = 0;
+  const struct ieee80211_hdr* hdr = NULL;
+  struct ieee80211_hdr hdrbuf;
+  unsigned int hdrlen = offsetof(struct ieee80211_hdr, addr3);
+  struct rtap_device_stats* stats = NULL;
+  struct rtap_device_rxent e = { 0 };
+
+  // Update this CPU's device counters; softirq is their only writer
+  stats = this_cpu_ptr(d->stats);
+  u64_stats_update_begin(&stats->syncp);
+  e.pkts = ++stats->pkts;
+  e.bytes = (stats->bytes += skb->len);
+  u64_stats_update_end(&stats->syncp);
+
+  // Free frames no filter could match without ever queueing them
+  hdr = rtap_device_get_hdr(skb, &hdrbuf, &hdrlen);
+  if (d->prefilter && !rtap_filter_prematch(skb->len, (hdr ? &hdr->frame_control : NULL)))
+  {
+    this_cpu_inc(*d->prefiltered);
+    consume_skb(skb);
+    return (0);
+  }
+
+  // Only frames that go on to the filters pay for a timestamp
+  e.rxtime = ktime_get_ns();
+  e.skb = skb;
+  e.cls = rtap_device_classify(hdr);
+
+  // Run filters right here; sends must not block
+  if (d->mode == RTAP_DEVICE_MODE_INLINE)
+  {
+    rtap_device_rx_process(d, &e, smp_processor_id(), MSG_DONTWAIT);
+    consume_skb(skb);
+    return (0);
+  }
+
+  // Hand frame off to worker; admission and drops are per class per CPU
+  if (rtap_device_ring_put(&d->workers[rtap_device_steer(d, hdr, hdrlen)], &e))
+  {
+    kfree_skb(skb);
+    ret = -1;
+  }
+
+  // Return success
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_recv(struct sk_buff *skb, struct net_device *dev,
+    struct packet_type *pt, struct net_device *orig_dev)
+{
+  // Delivered with a reference of our own to a frame others also see
+  return (rtap_device_rx(to_rtap_device(pt, pt), skb));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static rx_handler_result_t
+rtap_device_rx_handler(struct sk_buff **pskb)
+{
+  struct sk_buff* skb = *pskb;
+  struct rtap_device* d = rcu_dereference(skb->dev->rx_handler_data);
+
+  // When consuming, the reference handed to us is ours to keep and nothing
+  // after this hook sees the frame; otherwise take one and let it continue
+  if (d->consume)
+  {
+    rtap_device_rx(d, skb);
+    return (RX_HANDLER_CONSUMED);
+  }
+  rtap_device_rx(d, skb_get(skb));
+  return (RX_HANDLER_PASS);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_attach(struct rtap_device* d)
+{
+  int ret = 0;
+
+  ASSERT_RTNL();
+  if (d->attach == RTAP_DEVICE_ATTACH_RXH)
+  {
+    ret = netdev_rx_handler_register(d->pt.dev, rtap_device_rx_handler, d);
+  }
+  else
+  {
+    dev_add_pack(&d->pt);
+  }
+
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+__rtap_device_detach(struct rtap_device* d)
+{
+  // Caller must wait for in-flight receive hooks before freeing the device
+  ASSERT_RTNL();
+  if (d->attach == RTAP_DEVICE_ATTACH_RXH)
+  {
+    netdev_rx_handler_unregister(d->pt.dev);
+  }
+  else
+  {
+    __dev_remove_pack(&d->pt);
+  }
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_destroy(struct rtap_device* d)
+{
+  if (d)
+  {
+    rtap_device_workers_stop(d);
+    free_cpumask_var(d->cpus);
+    free_percpu(d->prefiltered);
+    free_percpu(d->stats);
+    free_percpu(d->lat);
+    kfree(rcu_dereference_protected(d->rtcache, 1));
+    if (d->pt.dev)
+    {
+      dev_put(d->pt.dev);
+    }
+    kfree(d);
+  }
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_opts_copy(struct rtap_device_opts* to, const struct rtap_device_opts* from)
+{
+  // Everything ahead of the CPU mask is plain data
+  memcpy(to, from, offsetof(struct rtap_device_opts, cpus));
+  cpumask_copy(to->cpus, from->cpus);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static bool
+rtap_device_is_pattern(const char* name)
+{
+  return (strpbrk(name, "*?") != NULL);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct rtap_device_pattern*
+rtap_device_pattern_find(const char* name, bool match)
+{
+  struct rtap_device_pattern* pat = NULL;
+
+  // Look up pattern by its own text, or the first one an interface matches
+  ASSERT_RTNL();
+  list_for_each_entry(pat, &rtap_device_patterns, list)
+  {
+    if (match ? match_wildcard(pat->name, name) : !strcmp(pat->name, name))
+    {
+      return (pat);
+    } // end if
+  } // end loop
+
+  return (NULL);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct rtap_device*
+rtap_device_find(const struct net_device* netdev)
+{
+  struct rtap_device* dev = NULL;
+
+  ASSERT_RTNL();
+  list_for_each_entry(dev, &rtap_devices.list, list)
+  {
+    if (dev->pt.dev == netdev)
+    {
+      return (dev);
+    } // end if
+  } // end loop
+
+  return (NULL);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+__rtap_device_remove(struct rtap_device* dev)
+{
+  ASSERT_RTNL();
+  printk( KERN_INFO "RTAP: Removing device: %s\n", dev->pt.dev->name );
+  list_del_rcu( &dev->list );
+  __rtap_device_detach( dev );
+  // Waits for in-flight receive hooks and list readers
+  synchronize_net();
+  rtap_device_destroy( dev );
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_pattern_remove(struct rtap_device_pattern* pat)
+{
+  struct rtap_device *dev = NULL;
+  struct rtap_device *tmp = NULL;
+
+  // Detach every interface the pattern brought in, then drop the pattern
+  ASSERT_RTNL();
+  list_for_each_entry_safe(dev, tmp, &rtap_devices.list, list)
+  {
+    if (dev->pat == pat)
+    {
+      __rtap_device_remove(dev);
+    } // end if
+  } // end loop
+  printk( KERN_INFO "RTAP: Removing device pattern: %s\n", pat->name );
+  list_del(&pat->list);
+  free_cpumask_var(pat->opts.cpus);
+  kfree(pat);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_remove(const char *devname)
+{
+  struct rtap_device_pattern *pat = NULL;
+  struct rtap_device *dev = NULL;
+  struct net_device *netdev = NULL;
+  int ret = -1;
+
+  // Search for device or pattern and remove
+  rtnl_lock();
+  if (rtap_device_is_pattern(devname))
+  {
+    pat = rtap_device_pattern_find(devname, false);
+    if (pat)
+    {
+      rtap_device_pattern_remove(pat);
+      ret = 0;
+    } // end if
+  } // end if
+  else
+  {
+    netdev = __dev_get_by_name(&init_net, devname);
+    dev = (netdev ? rtap_device_find(netdev) : NULL);
+    if (dev)
+    {
+      __rtap_device_remove(dev);
+      ret = 0;
+    } // end if
+  } // end else
+  rtnl_unlock();
+
+  // Return zero on success; negative on error
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct rtap_device *
+__rtap_device_add(struct net_device *netdev, const struct rtap_device_opts* opts,
+    struct rtap_device_pattern* pat)
+{
+  struct rtap_device *dev = 0;
+  const char* devname = netdev->name;
+
+  ASSERT_RTNL();
+
+  // First remove any existing device on same interface
+  dev = rtap_device_find(netdev);
+  if (dev)
+  {
+    __rtap_device_remove(dev);
+  } // end if
+
+  // Owning frames through an rx_handler is only safe on monitor interfaces
+  if ((opts->attach == RTAP_DEVICE_ATTACH_RXH) && (netdev->type != ARPHRD_IEEE80211_RADIOTAP))
+  {
+    printk( KERN_ERR "RTAP: Device '%s' is not a monitor interface\n", devname);
+    return (0);
+  } // end if
+
+  // Allocate new device list item
+  dev = kmalloc(sizeof(struct rtap_device), GFP_KERNEL);
+  if (!dev)
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate memory: dev[%s]\n", devname);
+    return (0);
+  } // end if
+  memset((void *) dev, 0, sizeof(struct rtap_device));
+  spin_lock_init(&dev->lock);
+
+  // Populate device list item; the interface is held until the device goes
+  dev_hold(netdev);
+  dev->pt.dev = netdev;
+  dev->pt.type = htons(ETH_P_ALL);
+  dev->pt.func = rtap_device_recv;
+  dev->pat = pat;
+  dev->ring_depth = opts->ring_depth;
+  dev->nworkers = opts->nworkers;
+  dev->budget = opts->budget;
+  dev->poll_us = opts->poll_us;
+  dev->poll_rate = opts->poll_rate;
+  dev->prefilter = opts->prefilter;
+  dev->attach = opts->attach;
+  dev->mode = opts->mode;
+  dev->consume = opts->consume;
+  dev->node = opts->node;
+  dev->policy = opts->policy;
+  dev->prio = opts->prio;
+  if (opts->reserve_set)
+  {
+    memcpy(dev->reserve, opts->reserve, sizeof(dev->reserve));
+  }
+  else
+  {
+    // By default management frames get the largest guaranteed share
+    dev->reserve[RTAP_DEVICE_CLASS_MGMT] = dev->ring_depth / 4;
+    dev->reserve[RTAP_DEVICE_CLASS_CTRL] = dev->ring_depth / 16;
+    dev->reserve[RTAP_DEVICE_CLASS_DATA] = dev->ring_depth / 8;
+  }
+  dev->shared = dev->ring_depth - (dev->reserve[RTAP_DEVICE_CLASS_MGMT] +
+      dev->reserve[RTAP_DEVICE_CLASS_CTRL] + dev->reserve[RTAP_DEVICE_CLASS_DATA]);
+  if (!zalloc_cpumask_var(&dev->cpus, GFP_KERNEL))
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate memory: dev[%s]\n", devname);
+    rtap_device_destroy(dev);
+    return (0);
+  } // end if
+  cpumask_copy(dev->cpus, opts->cpus);
+  dev->prefiltered = alloc_percpu(u32);
+  dev->stats = netdev_alloc_pcpu_stats(struct rtap_device_stats);
+  dev->lat = alloc_percpu(struct rtap_device_lat);
+  if (!dev->prefiltered || !dev->stats || !dev->lat)
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate memory: dev[%s]\n", devname);
+    rtap_device_destroy(dev);
+    return (0);
+  } // end if
+
+  // Initialize workers and their per-CPU receive rings
+  if (rtap_device_workers_start(dev, devname))
+  {
+    printk( KERN_CRIT "RTAP: Cannot start workers: dev[%s]\n", devname);
+    rtap_device_destroy(dev);
+    return (0);
+  } // end if
+
+  // Add device list item to tail of device list
+  list_add_tail_rcu(&dev->list, &rtap_devices.list);
+
+  // Register for packet
+  if (rtap_device_attach(dev))
+  {
+    printk( KERN_ERR "RTAP: Cannot attach to device: %s\n", devname);
+    list_del_rcu(&dev->list);
+    synchronize_net();
+    rtap_device_destroy(dev);
+    return (0);
+  } // end if
+
+  printk( KERN_INFO "RTAP: Added device: %s\n", devname);
+
+  // Return non-null device on success; null on error
+  return (dev);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_add(const char *devname, const struct rtap_device_opts* opts)
+{
+  struct rtap_device_pattern *pat = NULL;
+  struct net_device *netdev = NULL;
+  int ret = -1;
+
+  rtnl_lock();
+  if (rtap_device_is_pattern(devname))
+  {
+    if (strlen(devname) >= IFNAMSIZ)
+    {
+      printk( KERN_ERR "RTAP: Device pattern too long: %s\n", devname);
+      rtnl_unlock();
+      return (-1);
+    } // end if
+
+    // Replace any existing pattern with same text
+    pat = rtap_device_pattern_find(devname, false);
+    if (pat)
+    {
+      rtap_device_pattern_remove(pat);
+    } // end if
+
+    pat = kzalloc(sizeof(struct rtap_device_pattern), GFP_KERNEL);
+    if (!pat || !alloc_cpumask_var(&pat->opts.cpus, GFP_KERNEL))
+    {
+      printk( KERN_CRIT "RTAP: Cannot allocate memory: pattern[%s]\n", devname);
+      kfree(pat);
+      rtnl_unlock();
+      return (-1);
+    } // end if
+    strlcpy(pat->name, devname, sizeof(pat->name));
+    rtap_device_opts_copy(&pat->opts, opts);
+    list_add_tail(&pat->list, &rtap_device_patterns);
+    printk( KERN_INFO "RTAP: Added device pattern: %s\n", devname);
+
+    // Attach matching interfaces that are not already added by name
+    for_each_netdev(&init_net, netdev)
+    {
+      if (match_wildcard(pat->name, netdev->name) && !rtap_device_find(netdev))
+      {
+        __rtap_device_add(netdev, &pat->opts, pat);
+      } // end if
+    } // end loop
+    ret = 0;
+  } // end if
+  else
+  {
+    // Lookup network device by given name
+    netdev = __dev_get_by_name(&init_net, devname);
+    if (!netdev)
+    {
+      printk( KERN_ERR "RTAP: Device '%s' not found\n", devname);
+    } // end if
+    else if (__rtap_device_add(netdev, opts, NULL))
+    {
+      ret = 0;
+    } // end else if
+  } // end else
+  rtnl_unlock();
+
+  // Return zero on success; negative on error
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_clear(void)
+{
+  struct rtap_device_pattern *pat = NULL;
+  struct rtap_device_pattern *tmp_pat = NULL;
+  struct rtap_device *dev = NULL;
+  struct rtap_device *tmp = NULL;
+  LIST_HEAD(removed);
+
+  // Remove all devices from list
+  rtnl_lock();
+  list_for_each_entry(dev, &rtap_devices.list, list)
+  {
+    printk( KERN_INFO "RTAP: Removing device: %s\n", dev->pt.dev->name );
+    __rtap_device_detach( dev );
+  } // end loop
+
+  // Single grace period covers every unhooked device and list reader
+  list_splice_init_rcu(&rtap_devices.list, &removed, synchronize_net);
+  list_for_each_entry_safe(dev, tmp, &removed, list)
+  {
+    rtap_device_destroy( dev );
+  } // end loop
+
+  // Patterns no longer have any devices attached through them
+  list_for_each_entry_safe(pat, tmp_pat, &rtap_device_patterns, list)
+  {
+    rtap_device_pattern_remove( pat );
+  } // end loop
+  rtnl_unlock();
+
+  return (0);
+}
+
+/******************************************************************************
+ * Runs under RTNL, so interfaces come and go together with their rtap device
+ * and the device list never refers to an interface that is gone.
+ ******************************************************************************/
+static int
+rtap_device_notify(struct notifier_block *nb, unsigned long event, void *ptr)
+{
+  struct net_device *netdev = netdev_notifier_info_to_dev(ptr);
+  struct rtap_device_pattern *pat = NULL;
+  struct rtap_device *dev = NULL;
+
+  if (!net_eq(dev_net(netdev), &init_net))
+  {
+    return (NOTIFY_DONE);
+  } // end if
+
+  dev = rtap_device_find(netdev);
+  switch (event)
+  {
+  case NETDEV_REGISTER:
+  case NETDEV_CHANGENAME:
+    // Interfaces added by name stay; the rest follow the patterns
+    if (dev && !dev->pat)
+    {
+      break;
+    } // end if
+    pat = rtap_device_pattern_find(netdev->name, true);
+    if (pat && (!dev || (dev->pat != pat)))
+    {
+      __rtap_device_add(netdev, &pat->opts, pat);
+    } // end if
+    else if (!pat && dev)
+    {
+      __rtap_device_remove(dev);
+    } // end else if
+    break;
+
+  case NETDEV_UNREGISTER:
+    if (dev)
+    {
+      __rtap_device_remove(dev);
+    } // end if
+    break;
+
+  default:
+    break;
+  }
+
+  return (NOTIFY_DONE);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+const struct rtap_device_skbmeta*
+rtap_device_get_skbmeta(struct rtap_frame* f)
+{
+  struct rtap_device_skbmeta* skbmeta = &f->meta;
+  struct timespec ts = { 0 };
+
+  BUILD_BUG_ON(sizeof(struct rtap_device_skbmeta) != 0x30);
+
+  if (!f->meta_valid)
+  {
+    // Convert sk_buff ktime_t timestamp
+    ts = ktime_to_timespec(f->skb->tstamp);
+
+    // Populate metadata header
+    skbmeta->magic = cpu_to_be32(RTAP_MAGIC);
+    skbmeta->ver = RTAP_VER;
+    skbmeta->hdrlen = sizeof(struct rtap_device_skbmeta);
+    memcpy(&skbmeta->ethaddr, &f->dev->perm_addr, ETH_ALEN);
+    skbmeta->len = cpu_to_be32(f->skb->len + sizeof(struct rtap_device_skbmeta));
+    skbmeta->cpu = cpu_to_be32(f->cpu);
+    skbmeta->pktid = cpu_to_be64(f->pkts);
+    skbmeta->bytecnt = cpu_to_be64(f->bytes);
+    skbmeta->secs = cpu_to_be32(ts.tv_sec);
+    skbmeta->nsecs = cpu_to_be32(ts.tv_nsec);
+    f->meta_valid = true;
+  }
+
+  return (skbmeta);
+}
+
+/******************************************************************************
+ * Length of the 802.11 header with the given frame control, up to the body.
+ ******************************************************************************/
+static unsigned int
+rtap_device_hdrlen(__le16 fc)
+{
+  unsigned int len = 24;
+
+  if (ieee80211_is_ctl(fc))
+  {
+    // Receiver address only, or receiver and transmitter
+    return ((ieee80211_is_ack(fc) || ieee80211_is_cts(fc)) ? 10 : 16);
+  }
+  if (ieee80211_is_data(fc) && ieee80211_has_a4(fc))
+  {
+    len += ETH_ALEN;
+  }
+  if (ieee80211_is_data_qos(fc))
+  {
+    len += IEEE80211_QOS_CTL_LEN;
+  }
+  if (ieee80211_has_order(fc) && (ieee80211_is_mgmt(fc) || ieee80211_is_data_qos(fc)))
+  {
+    len += IEEE80211_HT_CTL_LEN;
+  }
+
+  return (len);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_parse(const struct sk_buff* skb, struct rtap_frame_desc* desc)
+{
+  const struct ieee80211_radiotap_header* rthdr = NULL;
+  struct ieee80211_radiotap_header rtbuf;
+  const struct ieee80211_hdr* hdr = NULL;
+  u8 hdrbuf[sizeof(struct ieee80211_hdr) + IEEE80211_QOS_CTL_LEN + IEEE80211_HT_CTL_LEN];
+  unsigned int len = 0;
+  __le16 fc = 0;
+
+  memset(desc, 0, sizeof(*desc));
+  desc->tid = RTAP_DESC_TID_NONE;
+
+  rthdr = skb_header_pointer(skb, 0, sizeof(rtbuf), &rtbuf);
+  if (!rthdr)
+  {
+    return;
+  }
+  desc->rtlen = get_unaligned_le16(&rthdr->it_len);
+  desc->present = get_unaligned_le32(&rthdr->it_present);
+  desc->payload = desc->rtlen;
+  if ((desc->rtlen < sizeof(rtbuf)) || (skb->len < (desc->rtlen + sizeof(fc))))
+  {
+    return;
+  }
+
+  // One copy at most, and only if the header straddles a fragment
+  len = min_t(unsigned int, sizeof(hdrbuf), skb->len - desc->rtlen);
+  hdr = skb_header_pointer(skb, desc->rtlen, len, hdrbuf);
+  if (!hdr)
+  {
+    return;
+  }
+  fc = hdr->frame_control;
+  desc->fctl = fc;
+  if (len < rtap_device_hdrlen(fc))
+  {
+    return;
+  }
+  desc->hdrlen = rtap_device_hdrlen(fc);
+  desc->payload += desc->hdrlen;
+
+  if (ieee80211_is_ctl(fc))
+  {
+    memcpy(desc->addr[RTAP_ADDR_RA], hdr->addr1, ETH_ALEN);
+    desc->roles = BIT(RTAP_ADDR_RA);
+    if (desc->hdrlen >= 16)
+    {
+      memcpy(desc->addr[RTAP_ADDR_TA], hdr->addr2, ETH_ALEN);
+      desc->roles |= BIT(RTAP_ADDR_TA);
+    }
+    return;
+  }
+
+  // Address 1 and 2 are always receiver and transmitter; source,
+  // destination and BSSID move around with the distribution system bits
+  desc->seqctl = hdr->seq_ctrl;
+  memcpy(desc->addr[RTAP_ADDR_RA], hdr->addr1, ETH_ALEN);
+  memcpy(desc->addr[RTAP_ADDR_TA], hdr->addr2, ETH_ALEN);
+  desc->roles = BIT(RTAP_ADDR_RA) | BIT(RTAP_ADDR_TA) | BIT(RTAP_ADDR_SA) | BIT(RTAP_ADDR_DA);
+  if (ieee80211_is_mgmt(fc) || (!ieee80211_has_tods(fc) && !ieee80211_has_fromds(fc)))
+  {
+    memcpy(desc->addr[RTAP_ADDR_DA], hdr->addr1, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_SA], hdr->addr2, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_BSSID], hdr->addr3, ETH_ALEN);
+    desc->roles |= BIT(RTAP_ADDR_BSSID);
+  }
+  else if (!ieee80211_has_tods(fc))
+  {
+    memcpy(desc->addr[RTAP_ADDR_DA], hdr->addr1, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_BSSID], hdr->addr2, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_SA], hdr->addr3, ETH_ALEN);
+    desc->roles |= BIT(RTAP_ADDR_BSSID);
+  }
+  else if (!ieee80211_has_fromds(fc))
+  {
+    memcpy(desc->addr[RTAP_ADDR_BSSID], hdr->addr1, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_SA], hdr->addr2, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_DA], hdr->addr3, ETH_ALEN);
+    desc->roles |= BIT(RTAP_ADDR_BSSID);
+  }
+  else
+  {
+    // Four address frames carry no BSSID
+    memcpy(desc->addr[RTAP_ADDR_DA], hdr->addr3, ETH_ALEN);
+    memcpy(desc->addr[RTAP_ADDR_SA], hdr->addr4, ETH_ALEN);
+  }
+
+  if (ieee80211_is_data_qos(fc))
+  {
+    desc->tid = *ieee80211_get_qos_ctl((struct ieee80211_hdr*) hdr) & IEEE80211_QOS_CTL_TID_MASK;
+  }
+}
+
+/******************************************************************************
+ * Parses the frame headers on first use; every filter then reads the same
+ * descriptor instead of walking the headers again.
+ ******************************************************************************/
+const struct rtap_frame_desc*
+rtap_device_get_desc(struct rtap_frame* f)
+{
+  BUILD_BUG_ON(sizeof(struct rtap_frame_desc) > 64);
+
+  if (!f->desc_valid)
+  {
+    rtap_device_parse(f->skb, &f->desc);
+    f->desc_valid = true;
+  }
+
+  return (&f->desc);
+}
+
+/******************************************************************************
+ * Stores one radiotap field; returns false if it holds nothing usable.
+ ******************************************************************************/
+static bool
+rtap_device_rtfield(struct rtap_frame_rtfields* rt, u32 idx, const u8* arg)
+{
+  int i = 0;
+
+  switch (idx)
+  {
+  case IEEE80211_RADIOTAP_TSFT:
+    rt->tsft = get_unaligned_le64(arg);
+    break;
+  case IEEE80211_RADIOTAP_FLAGS:
+    rt->flags = arg[0];
+    break;
+  case IEEE80211_RADIOTAP_RATE:
+    rt->rate = arg[0];
+    break;
+  case IEEE80211_RADIOTAP_CHANNEL:
+    rt->freq = get_unaligned_le16(arg);
+    rt->chanflags = get_unaligned_le16(arg + 2);
+    break;
+  case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+    rt->signal = (s8) arg[0];
+    break;
+  case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+    rt->noise = (s8) arg[0];
+    break;
+  case IEEE80211_RADIOTAP_MCS:
+    // Known, flags, index
+    if (!(arg[0] & IEEE80211_RADIOTAP_MCS_HAVE_MCS))
+    {
+      return (false);
+    }
+    rt->mcs = arg[2];
+    break;
+  case IEEE80211_RADIOTAP_VHT:
+    // Known, flags, bandwidth, then MCS/NSS per user
+    for (i = 0; i < 4; i++)
+    {
+      rt->nss = max_t(u8, rt->nss, arg[4 + i] & 0x0f);
+    } // end loop
+    break;
+  default:
+    return (false);
+  }
+
+  return (true);
+}
+
+/******************************************************************************
+ * Copies the chain of present words; false if the layout cannot be cached.
+ ******************************************************************************/
+static bool
+rtap_device_rtpresent(const u8* data, u16 rtlen, u32* present)
+{
+  u32 word = 0;
+  int i = 0;
+
+  memset(present, 0, RTAP_DEVICE_RTWORDS * sizeof(u32));
+  for (i = 0; (i < RTAP_DEVICE_RTWORDS) && (rtlen >= (8 + (i * 4))); i++)
+  {
+    word = get_unaligned_le32(data + 4 + (i * 4));
+    present[i] = word;
+    if (word & BIT(IEEE80211_RADIOTAP_VENDOR_NAMESPACE))
+    {
+      return (false);
+    }
+    if (!(word & BIT(IEEE80211_RADIOTAP_EXT)))
+    {
+      return (true);
+    }
+  } // end loop
+
+  return (false);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static const struct rtap_device_rtlayout*
+rtap_device_rtlayout_find(const struct rtap_device_rtcache* c, const u32* present)
+{
+  u32 i = 0;
+
+  for (i = 0; c && (i < c->nlayouts); i++)
+  {
+    if (!memcmp(c->layouts[i].present, present, sizeof(c->layouts[i].present)))
+    {
+      return (&c->layouts[i]);
+    }
+  } // end loop
+
+  return (NULL);
+}
+
+/******************************************************************************
+ * Publishes a new copy of the cache with one more layout; a full cache is
+ * left alone and the remaining layouts keep using the iterator.
+ ******************************************************************************/
+static void
+rtap_device_rtlayout_add(struct rtap_device* d, const struct rtap_device_rtlayout* l)
+{
+  struct rtap_device_rtcache* c = NULL;
+  struct rtap_device_rtcache* old = NULL;
+  u32 n = 0;
+
+  spin_lock_bh(&d->lock);
+  old = rcu_dereference_protected(d->rtcache, lockdep_is_held(&d->lock));
+  n = (old ? old->nlayouts : 0);
+
+  // Another worker may have added the same layout meanwhile
+  if ((n < RTAP_DEVICE_RTLAYOUTS) && !rtap_device_rtlayout_find(old, l->present))
+  {
+    c = kmalloc(sizeof(struct rtap_device_rtcache) + ((n + 1) * sizeof(*l)), GFP_ATOMIC);
+    if (c)
+    {
+      if (n)
+      {
+        memcpy(c->layouts, old->layouts, n * sizeof(*l));
+      }
+      c->layouts[n] = *l;
+      c->nlayouts = n + 1;
+      rcu_assign_pointer(d->rtcache, c);
+      if (old)
+      {
+        kfree_rcu(old, rcu);
+      }
+    }
+  }
+  spin_unlock_bh(&d->lock);
+}
+
+/******************************************************************************
+ * Extracts radiotap fields at offsets cached for the frame's present words,
+ * or walks the header with the iterator and caches what it finds.
+ ******************************************************************************/
+static void
+rtap_device_parse_rtfields(struct rtap_device* d, const struct sk_buff* skb, u16 rtlen,
+    struct rtap_frame_rtfields* rt)
+{
+  struct ieee80211_radiotap_iterator it;
+  const struct rtap_device_rtlayout* l = NULL;
+  struct rtap_device_rtlayout nl;
+  const u8* data = NULL;
+  u8 buf[RTAP_DEVICE_RTHDR_MAX];
+  bool cacheable = false;
+  u32 idx = 0;
+  int ret = 0;
+
+  memset(rt, 0, sizeof(*rt));
+
+  // Fields are read in place, so the whole header has to be in one piece
+  if (rtlen <= skb_headlen(skb))
+  {
+    data = skb->data;
+  }
+  else if (rtlen <= sizeof(buf))
+  {
+    data = skb_header_pointer(skb, 0, rtlen, buf);
+  }
+  if (!data || (rtlen < sizeof(struct ieee80211_radiotap_header)))
+  {
+    return;
+  }
+
+  memset(&nl, 0, sizeof(nl));
+  cacheable = (d && rtap_device_rtpresent(data, rtlen, nl.present));
+  if (cacheable)
+  {
+    rcu_read_lock();
+    l = rtap_device_rtlayout_find(rcu_dereference(d->rtcache), nl.present);
+    if (l && (rtlen >= l->rtlen_min))
+    {
+      for (idx = 0; idx < ARRAY_SIZE(l->off); idx++)
+      {
+        if ((l->have & BIT(idx)) && rtap_device_rtfield(rt, idx, data + l->off[idx]))
+        {
+          rt->have |= BIT(idx);
+        }
+      } // end loop
+      rcu_read_unlock();
+      return;
+    }
+    rcu_read_unlock();
+  }
+
+  if (ieee80211_radiotap_iterator_init(&it, (struct ieee80211_radiotap_header*) data,
+      rtlen, NULL))
+  {
+    return;
+  }
+  while (!(ret = ieee80211_radiotap_iterator_next(&it)))
+  {
+    // Only the first occurrence in the default namespace
+    idx = it.this_arg_index;
+    if (!it.is_radiotap_ns || (idx >= ARRAY_SIZE(nl.off)) ||
+        !(RTAP_DEVICE_RTFIELDS & BIT(idx)) || (nl.have & BIT(idx)))
+    {
+      continue;
+    }
+    nl.have |= BIT(idx);
+    nl.off[idx] = it.this_arg - data;
+    nl.rtlen_min = max_t(u16, nl.rtlen_min, nl.off[idx] + it.this_arg_size);
+    if (rtap_device_rtfield(rt, idx, it.this_arg))
+    {
+      rt->have |= BIT(idx);
+    }
+  } // end loop
+
+  // Only a header walked to its end describes the whole layout
+  if (cacheable && (ret == -ENOENT))
+  {
+    rtap_device_rtlayout_add(d, &nl);
+  }
+}
+
+/******************************************************************************
+ * Extracts the radiotap fields on first use; usually a lookup in the
+ * device's layout cache.
+ ******************************************************************************/
+const struct rtap_frame_rtfields*
+rtap_device_get_rtfields(struct rtap_frame* f)
+{
+  if (!f->rtfields_valid)
+  {
+    rtap_device_parse_rtfields(f->owner, f->skb, rtap_device_get_desc(f)->rtlen,
+        &f->rtfields);
+    f->rtfields_valid = true;
+  }
+
+  return (&f->rtfields);
+}
+
+/******************************************************************************
+ * Called from softirq when an inline send would block; queues the send to a
+ * worker, which retries it without running the filters again.
+ ******************************************************************************/
+int
+rtap_device_defer(struct rtap_frame* f, struct rtap_listener* l)
+{
+  struct rtap_device* d = f->owner;
+  const struct ieee80211_hdr* hdr = NULL;
+  struct ieee80211_hdr hdrbuf;
+  unsigned int hdrlen = offsetof(struct ieee80211_hdr, addr3);
+  struct rtap_device_rxent e = { 0 };
+
+  // First deferral of a frame holds its latency until every send completes
+  if (!f->pending)
+  {
+    f->pending = kmalloc(sizeof(struct rtap_device_pending), GFP_ATOMIC);
+    if (!f->pending)
+    {
+      return (-ENOMEM);
+    }
+    atomic_set(&f->pending->refs, 1);
+    f->pending->sent = false;
+  }
+
+  hdr = rtap_device_get_hdr(f->skb, &hdrbuf, &hdrlen);
+  e.skb = skb_get(f->skb);
+  e.l = listener_get(l);
+  e.pend = f->pending;
+  atomic_inc(&e.pend->refs);
+  e.pkts = f->pkts;
+  e.bytes = f->bytes;
+  e.rxtime = f->rxtime;
+  e.cls = rtap_device_classify(hdr);
+  if (rtap_device_ring_put(&d->workers[rtap_device_steer(d, hdr, hdrlen)], &e))
+  {
+    kfree_skb(e.skb);
+    listener_put(e.l);
+    atomic_dec(&e.pend->refs); // Frame's own reference is still held
+    return (-ENOBUFS);
+  }
+  this_cpu_inc(d->lat->deferred);
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static u64
+rtap_device_lat_bound(u32 bucket)
+{
+  u32 lg = 0;
+
+  // Smallest latency that falls into the bucket after the given one
+  bucket++;
+  if (bucket < (1 << RTAP_DEVICE_LAT_SUB))
+  {
+    return (bucket);
+  }
+  lg = (bucket >> RTAP_DEVICE_LAT_SUB) + RTAP_DEVICE_LAT_SUB - 1;
+  return ((1ULL << lg) |
+      ((u64) (bucket & ((1 << RTAP_DEVICE_LAT_SUB) - 1)) << (lg - RTAP_DEVICE_LAT_SUB)));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void
+rtap_device_sent(struct rtap_frame* f)
+{
+  // Latency is recorded once per frame after all of its sends; see rx_process
+  f->sent = true;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct notifier_block rtap_device_nb =
+{
+    .notifier_call = rtap_device_notify,
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int
+rtap_device_init(void)
+{
+  spin_lock_init(&rtap_devices.lock);
+  INIT_LIST_HEAD(&rtap_devices.list);
+
+  // Bounded pool shared by every device in wq mode
+  rtap_device_wq = alloc_workqueue("rtap", WQ_UNBOUND | WQ_HIGHPRI, 0);
+  if (!rtap_device_wq)
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate workqueue\n");
+    return (-ENOMEM);
+  }
+
+  // Follow interfaces as they register, rename and unregister
+  if (register_netdevice_notifier(&rtap_device_nb))
+  {
+    printk( KERN_CRIT "RTAP: Cannot register netdevice notifier\n");
+    destroy_workqueue(rtap_device_wq);
+    rtap_device_wq = NULL;
+    return (-ENOMEM);
+  }
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int
+rtap_device_exit(void)
+{
+  int ret = 0;
+
+  // Replays an unregister event for each interface, detaching all of them
+  unregister_netdevice_notifier(&rtap_device_nb);
+  ret = rtap_device_clear();
+  if (rtap_device_wq)
+  {
+    destroy_workqueue(rtap_device_wq);
+    rtap_device_wq = NULL;
+  }
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_stats_fold(struct rtap_device* d, u64* pkts, u64* bytes)
+{
+  int cpu;
+
+  *pkts = 0;
+  *bytes = 0;
+  for_each_possible_cpu(cpu)
+  {
+    const struct rtap_device_stats* stats = per_cpu_ptr(d->stats, cpu);
+    unsigned int start;
+    u64 p;
+    u64 b;
+    do
+    {
+      start = u64_stats_fetch_begin_irq(&stats->syncp);
+      p = stats->pkts;
+      b = stats->bytes;
+    } while (u64_stats_fetch_retry_irq(&stats->syncp, start));
+    *pkts += p;
+    *bytes += b;
+  } // end loop
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_device_lat_show(struct seq_file* file, struct rtap_device* d)
+{
+  static const u32 pct[] = { 500, 900, 990, 999 }; // Per mille
+  u64 total = 0;
+  u64 sum = 0;
+  u32 deferred = 0;
+  u32 b = 0;
+  u32 p = 0;
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+  {
+    const struct rtap_device_lat* lat = per_cpu_ptr(d->lat, cpu);
+    deferred += lat->deferred;
+    for (b = 0; b < RTAP_DEVICE_LAT_BUCKETS; b++)
+    {
+      total += lat->hist[b];
+    } // end loop
+  } // end loop
+
+  // Percentiles are reported as the upper bound of the bucket they fall in
+  seq_printf( file, "\tmode[%s]\tdeferred[%u]\tframes_sent[%llu]\tlatency[",
+      rtap_device_mode_str[d->mode], deferred, total );
+  for (b = 0; (b < RTAP_DEVICE_LAT_BUCKETS) && total && (p < ARRAY_SIZE(pct)); b++)
+  {
+    for_each_possible_cpu(cpu)
+    {
+      sum += per_cpu_ptr(d->lat, cpu)->hist[b];
+    } // end loop
+    for (; (p < ARRAY_SIZE(pct)) && ((sum * 1000) >= (total * pct[p])); p++)
+    {
+      seq_printf( file, "%sp%u.%u:%lluns", (p ? " " : ""), pct[p] / 10, pct[p] % 10,
+          rtap_device_lat_bound(b) );
+    } // end loop
+  } // end loop
+  seq_printf( file, "]\n" );
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+proc_show(struct seq_file *file, void *arg)
+{
+  struct rtap_device_pattern *pat = NULL;
+  struct rtap_device *dev = 0;
+
+  // Iterate over all devices in list
+  rcu_read_lock();
+  list_for_each_entry_rcu(dev, &rtap_devices.list, list)
+  {
+    const struct rtap_device_rtcache* rtc = NULL;
+    u32 drops[RTAP_DEVICE_CLASS_LAST] = { 0 };
+    u64 pkts = 0;
+    u64 bytes = 0;
+    u32 prefiltered = 0;
+    u32 dropped = 0;
+    u32 highwater = 0;
+    u32 i;
+    int cpu;
+    int c;
+    for_each_possible_cpu(cpu)
+    {
+      prefiltered += *per_cpu_ptr(dev->prefiltered, cpu);
+      for (i = 0; i < dev->nworkers; i++)
+      {
+        struct rtap_device_ring* r = per_cpu_ptr(dev->workers[i].rings, cpu);
+        for (c = 0; c < RTAP_DEVICE_CLASS_LAST; c++)
+        {
+          drops[c] += r->drops[c];
+          dropped += r->drops[c];
+        } // end loop
+        highwater = max(highwater, READ_ONCE(r->highwater));
+      } // end loop
+    } // end loop
+    rtap_device_stats_fold(dev, &pkts, &bytes);
+    seq_printf( file, "dev[%s]\tpkts[%llu]\tbytes[%llu]\tdropped[%u]\tring[%u]\thighwater[%u]\tworkers[%u]\tcpus[%*pbl]\tbudget[%u]\n",
+        dev->pt.dev->name, pkts, bytes,
+        dropped, dev->ring_depth, highwater,
+        dev->nworkers, cpumask_pr_args(dev->cpus), dev->budget );
+    for (c = 0; c < RTAP_DEVICE_CLASS_LAST; c++)
+    {
+      seq_printf( file, "\tclass[%s]\treserve[%u]\tdropped[%u]\n",
+          rtap_device_class_str[c], dev->reserve[c], drops[c] );
+    } // end loop
+    seq_printf( file, "\tclass[shared]\treserve[%u]\n", dev->shared );
+    if (dev->mode != RTAP_DEVICE_MODE_WQ)
+    {
+      seq_printf( file, "\tpoll[%uus]\tpollrate[%u]\n", dev->poll_us, dev->poll_rate );
+      seq_printf( file, "\tnode[%d]\tsched[%s:%d]\n", dev->node,
+          ((dev->policy == SCHED_FIFO) ? "fifo" : (dev->policy == SCHED_RR) ? "rr" : "nice"),
+          dev->prio );
+    }
+    else
+    {
+      // Shared workqueue; only the ring placement is ours to choose
+      seq_printf( file, "\tnode[%d]\n", dev->node );
+    }
+    seq_printf( file, "\tprefilter[%s]\tprefiltered[%u]\n",
+        (dev->prefilter ? "on" : "off"), prefiltered );
+    rtc = rcu_dereference(dev->rtcache);
+    seq_printf( file, "\tradiotap layouts[%u]\n", (rtc ? rtc->nlayouts : 0) );
+    seq_printf( file, "\tattach[%s]\tconsume[%s]\tpattern[%s]\n",
+        rtap_device_attach_str[dev->attach], (dev->consume ? "on" : "off"),
+        (dev->pat ? dev->pat->name : "-") );
+    rtap_device_lat_show(file, dev);
+    for (i = 0; i < dev->nworkers; i++)
+    {
+      struct rtap_device_worker* w = &dev->workers[i];
+      u32 whighwater = 0;
+      int b;
+      for_each_possible_cpu(cpu)
+      {
+        whighwater = max(whighwater, READ_ONCE(per_cpu_ptr(w->rings, cpu)->highwater));
+      } // end loop
+      seq_printf( file, "\tworker[%u]\tcpu[%d]\tframes[%u]\thighwater[%u]\tbursts[",
+          w->id, (w->task ? task_cpu(w->task) : -1), w->frames, whighwater );
+      for (b = 0; b < RTAP_DEVICE_BURST_BUCKETS; b++)
+      {
+        seq_printf( file, "%s%u:%u", (b ? " " : ""), (1U << b), w->bursts[b] );
+      } // end loop
+      seq_printf( file, "]\n" );
+      seq_printf( file, "\t\tstate[%s]\tswitches[%u]",
+          (w->polling ? "poll" : "irq"), w->switches );
+      for (b = 0; b < RTAP_DEVICE_WSTATE_LAST; b++)
+      {
+        seq_printf( file, "\t%s[%lluus]", rtap_device_wstate_str[b],
+            div_u64(w->ns[b], NSEC_PER_USEC) );
+      } // end loop
+      seq_printf( file, "\n" );
+    } // end loop
+    for_each_possible_cpu(cpu)
+    {
+      u32 cpudrops[RTAP_DEVICE_CLASS_LAST] = { 0 };
+      u32 overflow = 0;
+      for (i = 0; i < dev->nworkers; i++)
+      {
+        struct rtap_device_ring* r = per_cpu_ptr(dev->workers[i].rings, cpu);
+        for (c = 0; c < RTAP_DEVICE_CLASS_LAST; c++)
+        {
+          cpudrops[c] += r->drops[c];
+          overflow += r->drops[c];
+        } // end loop
+      } // end loop
+      if (overflow)
+      {
+        seq_printf( file, "\tcpu[%d]\toverflow[%u]\tmgmt[%u]\tctrl[%u]\tdata[%u]\n",
+            cpu, overflow, cpudrops[RTAP_DEVICE_CLASS_MGMT],
+            cpudrops[RTAP_DEVICE_CLASS_CTRL], cpudrops[RTAP_DEVICE_CLASS_DATA] );
+      }
+    } // end loop
+  } // end loop
+  rcu_read_unlock();
+
+  // Patterns stay registered whether or not anything matches them yet
+  rtnl_lock();
+  list_for_each_entry(pat, &rtap_device_patterns, list)
+  {
+    seq_printf( file, "pattern[%s]\n", pat->name );
+  } // end loop
+  rtnl_unlock();
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+proc_open(struct inode *inode, struct file *file)
+{
+  return (single_open(file, proc_show, NULL));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+proc_close(struct inode *inode, struct file *file)
+{
+  return (single_release(inode, file));
+}
 
 /******************************************************************************
  *
@@ -555,6 +2337,189 @@ proc_lseek(struct file *file, loff_t off, int cnt)
   return (seq_lseek(file, off, cnt));
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_parse_sched(char* val, struct rtap_device_opts* opts)
+{
+  char* pol = strsep(&val, ":");
+  int prio = 0;
+
+  // Accepts 'fifo:<1-99>', 'rr:<1-99>', 'nice:<-20-19>' or 'normal'
+  if (!strcmp(pol, "normal") && !val)
+  {
+    opts->policy = SCHED_NORMAL;
+    opts->prio = 0;
+  }
+  else if (!val || kstrtoint(val, 0, &prio))
+  {
+    return (-1);
+  }
+  else if (!strcmp(pol, "nice") && (prio >= MIN_NICE) && (prio <= MAX_NICE))
+  {
+    opts->policy = SCHED_NORMAL;
+    opts->prio = prio;
+  }
+  else if ((!strcmp(pol, "fifo") || !strcmp(pol, "rr")) &&
+      (prio > 0) && (prio < MAX_USER_RT_PRIO))
+  {
+    opts->policy = ((pol[0] == 'f') ? SCHED_FIFO : SCHED_RR);
+    opts->prio = prio;
+  }
+  else
+  {
+    return (-1);
+  }
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_device_parse_opts(char* str, struct rtap_device_opts* opts)
+{
+  char* tok = NULL;
+
+  // Defaults
+  opts->ring_depth = RTAP_DEVICE_RING_DEF;
+  opts->nworkers = 1;
+  opts->budget = RTAP_DEVICE_BUDGET_DEF;
+  opts->poll_us = 0;
+  opts->poll_rate = RTAP_DEVICE_POLL_RATE;
+  opts->prefilter = false;
+  opts->attach = RTAP_DEVICE_ATTACH_PTYPE;
+  opts->mode = RTAP_DEVICE_MODE_WORKER;
+  opts->consume = false;
+  opts->node = NUMA_NO_NODE;
+  opts->policy = SCHED_NORMAL;
+  opts->prio = 0;
+  cpumask_clear(opts->cpus);
+
+  // Options are whitespace separated 'key=value' pairs following device name
+  while ((tok = strsep(&str, " \t\n")))
+  {
+    char* val = tok;
+    char* key = strsep(&val, "=");
+    unsigned int n = 0;
+
+    if (!*key)
+    {
+      continue;
+    }
+    else if (!val)
+    {
+      printk( KERN_ERR "RTAP: Missing value for device option: %s\n", key);
+      return (-1);
+    }
+    else if (!strcmp(key, "ring") && !kstrtouint(val, 0, &n))
+    {
+      n = clamp_t(unsigned int, n, RTAP_DEVICE_RING_MIN, RTAP_DEVICE_RING_MAX);
+      opts->ring_depth = roundup_pow_of_two(n);
+    }
+    else if (!strcmp(key, "workers") && !kstrtouint(val, 0, &n) && n)
+    {
+      opts->nworkers = min_t(unsigned int, n, RTAP_DEVICE_WORKER_MAX);
+    }
+    else if (!strcmp(key, "reserve") && (sscanf(val, "%u,%u,%u",
+        &opts->reserve[RTAP_DEVICE_CLASS_MGMT], &opts->reserve[RTAP_DEVICE_CLASS_CTRL],
+        &opts->reserve[RTAP_DEVICE_CLASS_DATA]) == RTAP_DEVICE_CLASS_LAST))
+    {
+      opts->reserve_set = true;
+    }
+    else if (!strcmp(key, "budget") && !kstrtouint(val, 0, &n) && n)
+    {
+      opts->budget = min_t(unsigned int, n, RTAP_DEVICE_BUDGET_MAX);
+    }
+    else if (!strcmp(key, "poll") && !kstrtouint(val, 0, &n))
+    {
+      opts->poll_us = min_t(unsigned int, n, RTAP_DEVICE_POLL_MAX);
+    }
+    else if (!strcmp(key, "pollrate") && !kstrtouint(val, 0, &n))
+    {
+      opts->poll_rate = n;
+    }
+    else if (!strcmp(key, "prefilter") && !kstrtobool(val, &opts->prefilter))
+    {
+      // Value parsed in place
+    }
+    else if (!strcmp(key, "attach") && !strcmp(val, rtap_device_attach_str[RTAP_DEVICE_ATTACH_PTYPE]))
+    {
+      opts->attach = RTAP_DEVICE_ATTACH_PTYPE;
+    }
+    else if (!strcmp(key, "attach") && !strcmp(val, rtap_device_attach_str[RTAP_DEVICE_ATTACH_RXH]))
+    {
+      opts->attach = RTAP_DEVICE_ATTACH_RXH;
+    }
+    else if (!strcmp(key, "mode") && !strcmp(val, rtap_device_mode_str[RTAP_DEVICE_MODE_WORKER]))
+    {
+      opts->mode = RTAP_DEVICE_MODE_WORKER;
+    }
+    else if (!strcmp(key, "mode") && !strcmp(val, rtap_device_mode_str[RTAP_DEVICE_MODE_INLINE]))
+    {
+      opts->mode = RTAP_DEVICE_MODE_INLINE;
+    }
+    else if (!strcmp(key, "mode") && !strcmp(val, rtap_device_mode_str[RTAP_DEVICE_MODE_WQ]))
+    {
+      opts->mode = RTAP_DEVICE_MODE_WQ;
+    }
+    else if (!strcmp(key, "consume") && !kstrtobool(val, &opts->consume))
+    {
+      // Value parsed in place
+    }
+    else if (!strcmp(key, "cpus") && !cpulist_parse(val, opts->cpus))
+    {
+      cpumask_and(opts->cpus, opts->cpus, cpu_possible_mask);
+    }
+    else if (!strcmp(key, "node") && !kstrtoint(val, 0, &opts->node) &&
+        (opts->node >= 0) && (opts->node < MAX_NUMNODES) && node_online(opts->node))
+    {
+      // Value parsed in place
+    }
+    else if (!strcmp(key, "sched") && !rtap_device_parse_sched(val, opts))
+    {
+      // Value parsed in place
+    }
+    else
+    {
+      printk( KERN_ERR "RTAP: Invalid device option: %s=%s\n", key, val);
+      return (-1);
+    }
+  } // end while
+
+  // Only an rx_handler can keep frames from the rest of the stack
+  if (opts->consume && (opts->attach != RTAP_DEVICE_ATTACH_RXH))
+  {
+    printk( KERN_ERR "RTAP: consume requires attach=%s\n",
+        rtap_device_attach_str[RTAP_DEVICE_ATTACH_RXH]);
+    return (-1);
+  }
+
+  // Work items run on the shared workqueue; there is no thread to pin,
+  // schedule or busy-poll, so refuse settings that would be ignored
+  if ((opts->mode == RTAP_DEVICE_MODE_WQ) && (!cpumask_empty(opts->cpus) ||
+      (opts->policy != SCHED_NORMAL) || opts->prio || opts->poll_us ||
+      (opts->poll_rate != RTAP_DEVICE_POLL_RATE)))
+  {
+    printk( KERN_ERR "RTAP: cpus, sched, poll and pollrate not supported with mode=%s\n",
+        rtap_device_mode_str[RTAP_DEVICE_MODE_WQ]);
+    return (-1);
+  }
+
+  // Reservations are carved out of the ring and cannot exceed it
+  if (opts->reserve_set && ((opts->reserve[RTAP_DEVICE_CLASS_MGMT] +
+      opts->reserve[RTAP_DEVICE_CLASS_CTRL] + opts->reserve[RTAP_DEVICE_CLASS_DATA]) >
+      opts->ring_depth))
+  {
+    printk( KERN_ERR "RTAP: Reservations exceed ring depth: %u\n", opts->ring_depth);
+    return (-1);
+  }
+
+  return (0);
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -563,11 +2528,23 @@ proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
 {
   char devstr[256 + 1] = { 0 };
   char devname[256 + 1] = { 0 };
+  struct rtap_device_opts opts = { 0 };
+  int len = 0;
   int ret = 0;
 
   cnt = (cnt >= 256) ? 256 : cnt;
   copy_from_user(devstr, buf, cnt);
-  ret = sscanf(devstr, "%256s", devname);
+  ret = sscanf(devstr, "%256s%n", devname, &len);
+
+  if (!alloc_cpumask_var(&opts.cpus, GFP_KERNEL))
+  {
+    return (-ENOMEM);
+  } // end if
+  if ((ret == 1) && rtap_device_parse_opts(&devstr[len], &opts))
+  {
+    free_cpumask_var(opts.cpus);
+    return (-1);
+  } // end if
 
   if ((ret == 1) && (strlen(devname) == 1) && (devname[0] == '-'))
   {
@@ -581,19 +2558,21 @@ proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
     } // end if
     else if (devname[0] == '+')
     {
-      rtap_device_add(&devname[1]);
+      rtap_device_add(&devname[1], &opts);
     } // end else
     else
     {
-      rtap_device_add(devname);
+      rtap_device_add(devname, &opts);
     } // end else
   } // end else if
   else
   {
     printk( KERN_ERR "RTAP: Failed parsing device string: %s\n", devstr);
+    free_cpumask_var(opts.cpus);
     return (-1);
   } // end else
 
+  free_cpumask_var(opts.cpus);
   return (cnt);
 
 }
@@ -23,10 +23,107 @@
 #ifndef __DEVICE_H__
 #define __DEVICE_H__
 
+//*****************************************************************************
+// Includes
+//*****************************************************************************
+
+#include <linux/types.h>
+#include <linux/if_ether.h>
+#include <linux/skbuff.h>
+
 //*****************************************************************************
 // Type definitions
 //*****************************************************************************
 
+// Version 2 widens the counters to 64 bits. They are kept per CPU, so the
+// sequence is per (device, cpu); gaps within one CPU's stream mark drops.
+struct rtap_device_skbmeta
+{
+  u32 magic; // 'RTAP'
+  u8 ver; // Metadata header version; currently 0x02
+  u8 hdrlen; // Metadata header length; currently 0x30
+  u8 ethaddr[ETH_ALEN]; // Listening device address
+  u32 len; // Packet length including metadata header
+  u64 pktid; // Cumulative packet count on this CPU
+  u64 bytecnt; // Cumulative byte count on this CPU as seen by listening device
+  u32 secs; // Time packet was received by listening device
+  u32 nsecs;
+  u32 cpu; // CPU the packet was received on
+  u32 rsvd;
+};
+
+struct rtap_device;
+struct rtap_device_pending;
+struct rtap_listener;
+
+// Roles an 802.11 address can play; which header field holds each one
+// depends on the frame type and the ToDS/FromDS bits
+typedef enum rtap_addr_role
+{
+  RTAP_ADDR_SA = 0,
+  RTAP_ADDR_DA = 1,
+  RTAP_ADDR_TA = 2,
+  RTAP_ADDR_RA = 3,
+  RTAP_ADDR_BSSID = 4,
+  RTAP_ADDR_LAST
+} rtap_addr_role_t;
+
+#define RTAP_DESC_TID_NONE 0xff
+
+// Frame headers parsed once into what the filters look at; fits one cache
+// line. Offsets are from the start of the frame, i.e. the radiotap header.
+struct rtap_frame_desc
+{
+  u16 rtlen; // Radiotap header length; 0 if the frame has none
+  u16 hdrlen; // 802.11 header length; 0 if missing or truncated
+  u16 payload; // Offset of the frame body
+  __le16 fctl;
+  __le16 seqctl;
+  u8 tid; // QoS TID; RTAP_DESC_TID_NONE unless a QoS data frame
+  u8 roles; // Bit per rtap_addr_role_t held in 'addr'
+  u32 present; // First radiotap present word
+  u8 addr[RTAP_ADDR_LAST][ETH_ALEN];
+};
+
+// Radiotap fields the filters test, taken from the first occurrence of each
+// in the header; parsed separately, only for frames a radiotap filter sees
+struct rtap_frame_rtfields
+{
+  u32 have; // BIT(IEEE80211_RADIOTAP_*) for each field found
+  u8 flags; // IEEE80211_RADIOTAP_F_*
+  u8 rate; // Legacy rate in 500 kbps units
+  s8 signal; // Antenna signal in dBm
+  s8 noise; // Antenna noise in dBm
+  u16 freq; // Channel frequency in MHz
+  u16 chanflags; // IEEE80211_CHAN_*
+  u8 mcs; // HT MCS index
+  u8 nss; // VHT spatial streams of the widest user
+  u64 tsft; // Usecs
+};
+
+// Frame as handed from a device to the filters. The skb is shared with
+// the rest of the stack and must be treated as read-only; the metadata header
+// is only built once a rule decides to forward the frame.
+struct rtap_frame
+{
+  struct sk_buff* skb;
+  struct net_device* dev; // Listening device
+  struct rtap_device* owner;
+  unsigned int sendflags; // MSG_DONTWAIT when processed in softirq
+  u64 rxtime; // ktime_get_ns() when the frame reached rtap
+  u32 cpu;
+  u64 pkts;
+  u64 bytes;
+  bool meta_valid;
+  struct rtap_device_skbmeta meta;
+  bool desc_valid;
+  struct rtap_frame_desc desc;
+  bool rtfields_valid;
+  struct rtap_frame_rtfields rtfields;
+  bool sent; // At least one listener send succeeded
+  struct rtap_device_pending* pending; // Set once a send was deferred
+};
+
 //*****************************************************************************
 // Global variables
 //*****************************************************************************
@@ -40,5 +137,25 @@ extern const struct file_operations rtap_device_fops;
 extern int rtap_device_init( void );
 extern int rtap_device_exit( void );
 
+extern const struct rtap_device_skbmeta*
+rtap_device_get_skbmeta( struct rtap_frame* f );
+
+extern const struct rtap_frame_desc*
+rtap_device_get_desc( struct rtap_frame* f );
+
+extern const struct rtap_frame_rtfields*
+rtap_device_get_rtfields( struct rtap_frame* f );
+
+extern int
+rtap_device_defer( struct rtap_frame* f, struct rtap_listener* l );
+
+extern void
+rtap_device_sent( struct rtap_frame* f );
+
+static inline const u8*
+rtap_frame_desc_addr( const struct rtap_frame_desc* d, rtap_addr_role_t role )
+{
+  return ((d->roles & BIT(role)) ? d->addr[role] : NULL);
+}
 
 #endif
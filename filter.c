@@ -28,8 +28,17 @@
 
 #include <linux/module.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/srcu.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
+#include <linux/etherdevice.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 #include <linux/ieee80211.h>
 #include <net/mac80211.h>
 #include <net/ieee80211_radiotap.h>
@@ -39,23 +48,75 @@
 #include "listener.h"
 #include "rule.h"
 #include "stats.h"
+#include "macset.h"
 #include "filter.h"
 
 //*****************************************************************************
 // Type definitions
 //*****************************************************************************
 
+struct rtap_filter_ssid
+{
+  struct hlist_node node;
+  u8 len;
+  u8 ssid[IEEE80211_MAX_SSID_LEN];
+};
+
+struct rtap_filter_oui
+{
+  u8 oui[3];
+  u8 type;
+  bool any; // Any vendor specific type
+};
+
+// FILTER_TYPE_IE operand; built when the filter is added, read-only after.
+// SSID prefixes occupy the front of 'ssids' and exact names the rest.
+struct rtap_filter_ie
+{
+  DECLARE_BITMAP(ids, 256); // FILTER_SUBTYPE_IE_ID
+  u32 n; // Entries in 'ssids' or 'ouis'
+  u32 nprefix;
+  u32 hmask; // Exact SSID hash buckets - 1
+  struct hlist_head* buckets;
+  struct rtap_filter_ssid* ssids;
+  struct rtap_filter_oui* ouis;
+};
+
+// Everything the per-frame chain walk reads sits in the first cache line;
+// the id, lock and argument text are only used by the proc interface.
 struct rtap_filter
 {
   struct list_head list;
-  spinlock_t lock;
-  rtap_filter_id_t fid;
   rtap_filter_type_t type;
   rtap_filter_subtype_t subtype;
   struct rtap_rule* rule;
   unsigned int count;
-  char *arg;
-};
+  union
+  {
+    struct
+    {
+      u32 min;
+      u32 max;
+    } len; // FILTER_TYPE_ALL frame length range
+    struct bpf_prog* prog; // FILTER_TYPE_BPF
+    struct rtap_macset* set; // FILTER_TYPE_MACSET, FILTER_TYPE_MACPREFIX
+    struct rtap_filter_ie* ie; // FILTER_TYPE_IE
+    u8 mac[ETH_ALEN]; // FILTER_TYPE_80211 addresses
+    struct
+    {
+      u16 val;
+      u16 mask;
+    } fctl; // FILTER_TYPE_80211 frame control, FILTER_TYPE_RADIOTAP flags
+    struct
+    {
+      s64 min;
+      s64 max;
+    } range; // FILTER_TYPE_RADIOTAP values
+  } op; // Argument compiled when the filter is added
+  rtap_filter_id_t fid;
+  spinlock_t lock;
+  char *arg; // Argument as written; for display only
+} ____cacheline_aligned;
 
 struct rtap_chain
 {
@@ -65,21 +126,48 @@ struct rtap_chain
   struct rtap_filter filter;
 };
 
+// Conservative summary of everything the active filters could match, used to
+// reject frames in softirq context before they are queued to a worker
+struct rtap_filter_summary
+{
+  struct rcu_head rcu;
+  u64 fctl; // Bit per frame control type/subtype some filter can match
+  unsigned int len_min;
+  unsigned int len_max;
+};
+
+#define RTAP_FILTER_CMD_MAX     PAGE_SIZE
+#define RTAP_FILTER_ARG_MAX     255
+#define RTAP_FILTER_FCTL_ALL    (~0ULL)
+#define RTAP_FILTER_FCTL_MASK   (IEEE80211_FCTL_FTYPE | IEEE80211_FCTL_STYPE)
+#define RTAP_FILTER_FCTL_BIT(fc) \
+  (1ULL << ((le16_to_cpu(fc) & RTAP_FILTER_FCTL_MASK) >> 2))
+
 typedef int
-(*rtap_filter_func_t)(struct rtap_filter *fp, struct sk_buff *skb);
+(*rtap_filter_func_t)(struct rtap_filter *fp, struct rtap_frame *frame);
 
 //*****************************************************************************
 // Function prototypes
 //*****************************************************************************
 
 static int
-rtap_filter_all(struct rtap_filter *f, struct sk_buff *skb);
+rtap_filter_all(struct rtap_filter *f, struct rtap_frame *frame);
+static int
+rtap_filter_radiotap(struct rtap_filter *fp, struct rtap_frame *frame);
 static int
-rtap_filter_radiotap(struct rtap_filter *fp, struct sk_buff *skb);
+rtap_filter_80211(struct rtap_filter *fp, struct rtap_frame *frame);
 static int
-rtap_filter_80211(struct rtap_filter *fp, struct sk_buff *skb);
+rtap_filter_ip(struct rtap_filter *fp, struct rtap_frame *frame);
 static int
-rtap_filter_ip(struct rtap_filter *fp, struct sk_buff *skb);
+rtap_filter_bpf(struct rtap_filter *fp, struct rtap_frame *frame);
+static int
+rtap_filter_macset(struct rtap_filter *fp, struct rtap_frame *frame);
+static int
+rtap_filter_macprefix(struct rtap_filter *fp, struct rtap_frame *frame);
+static int
+rtap_filter_ie(struct rtap_filter *fp, struct rtap_frame *frame);
+static void
+rtap_filter_ie_free(struct rtap_filter_ie* ie);
 
 //*****************************************************************************
 // Global variables
@@ -89,6 +177,17 @@ rtap_filter_ip(struct rtap_filter *fp, struct sk_buff *skb);
 
 /* Local */
 
+// Address role each FILTER_TYPE_80211 address subtype matches
+static const rtap_addr_role_t rtap_filter_80211_role[] =
+{
+    [FILTER_SUBTYPE_80211_SA] = RTAP_ADDR_SA,
+    [FILTER_SUBTYPE_80211_DA] = RTAP_ADDR_DA,
+    [FILTER_SUBTYPE_80211_TA] = RTAP_ADDR_TA,
+    [FILTER_SUBTYPE_80211_RA] = RTAP_ADDR_RA,
+    [FILTER_SUBTYPE_80211_FCTL] = RTAP_ADDR_LAST,
+    [FILTER_SUBTYPE_80211_BSSID] = RTAP_ADDR_BSSID,
+};
+
 static rtap_filter_func_t rtap_filtertbl[] =
 {
     [FILTER_TYPE_NONE] = NULL,
@@ -98,15 +197,31 @@ static rtap_filter_func_t rtap_filtertbl[] =
     [FILTER_TYPE_IP] = &rtap_filter_ip,
     [FILTER_TYPE_UDP] = NULL,
     [FILTER_TYPE_TCP] = NULL,
+    [FILTER_TYPE_BPF] = &rtap_filter_bpf,
+    [FILTER_TYPE_MACSET] = &rtap_filter_macset,
+    [FILTER_TYPE_MACPREFIX] = &rtap_filter_macprefix,
+    [FILTER_TYPE_IE] = &rtap_filter_ie,
     [FILTER_TYPE_LAST] = NULL
 };
 
 static struct rtap_chain rtap_chains = { { 0 } }; // Dynamic rtap_filter chain
+static DEFINE_MUTEX(rtap_chains_mutex); // Serializes chain and filter updates
+DEFINE_STATIC_SRCU(rtap_chains_srcu); // Readers may sleep sending to listeners
+static struct rtap_filter_summary __rcu* rtap_filter_summary = NULL;
 
 //*****************************************************************************
 // Local Functions
 //*****************************************************************************
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_chains_sync(void)
+{
+  synchronize_srcu(&rtap_chains_srcu);
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -115,6 +230,28 @@ rtap_filter_destroy(struct rtap_filter* f)
 {
   if (f)
   {
+    if ((f->type == FILTER_TYPE_BPF) && f->op.prog)
+    {
+      if (f->subtype == FILTER_SUBTYPE_BPF_CLASSIC)
+      {
+        bpf_prog_destroy(f->op.prog);
+      }
+      else
+      {
+        bpf_prog_put(f->op.prog);
+      }
+    }
+    if ((f->type == FILTER_TYPE_MACSET) || (f->type == FILTER_TYPE_MACPREFIX))
+    {
+      // Reference taken by rtap_macset_get() when the filter was compiled
+      rtap_macset_put(f->op.set);
+      f->op.set = NULL;
+    }
+    if (f->type == FILTER_TYPE_IE)
+    {
+      rtap_filter_ie_free(f->op.ie);
+      f->op.ie = NULL;
+    }
     if (f->arg)
     {
       kfree(f->arg);
@@ -132,7 +269,9 @@ rtap_filter_create(void)
 
   struct rtap_filter* f = 0;
 
-  // Allocate new filter list item
+  BUILD_BUG_ON(offsetof(struct rtap_filter, fid) > 64);
+
+  // Allocate new filter list item; argument text is allocated when set
   f = kmalloc(sizeof(struct rtap_filter), GFP_KERNEL);
   if (!f)
   {
@@ -141,16 +280,6 @@ rtap_filter_create(void)
   } // end if
   memset((void *) f, 0, sizeof(struct rtap_filter));
 
-  // Allocate buffer for filter argument string
-  f->arg = kmalloc(256, GFP_KERNEL);
-  if (!f->arg)
-  {
-    printk( KERN_CRIT "RTAP: Cannot allocate memory\n");
-    rtap_filter_destroy(f);
-    return (NULL);
-  } // end if
-  memset((void *) f->arg, 0, 256);
-
   return (f);
 
 }
@@ -165,8 +294,12 @@ rtap_filter_remove(struct rtap_chain* c, struct rtap_filter* f)
   if (c && f)
   {
     printk( KERN_INFO "RTAP: Removing filter: %u from chain: %s\n", f->fid, c->name);
-    list_del(&f->list);
+    spin_lock_bh(&c->lock);
+    list_del_rcu(&f->list);
+    spin_unlock_bh(&c->lock);
+    rtap_chains_sync();
     rtap_filter_destroy(f);
+    ret = 0;
   }
   // Return NULL on success; negative on error
   return (ret);
@@ -185,9 +318,9 @@ rtap_filter_add(struct rtap_chain* c, struct rtap_filter* f)
 
     // Add device list item to tail of device list
     printk( KERN_INFO "RTAP: Adding filter: %s:%hu\n", c->name, f->fid);
-    spin_lock(&c->lock);
-    list_add_tail(&f->list, &c->filter.list);
-    spin_unlock(&c->lock);
+    spin_lock_bh(&c->lock);
+    list_add_tail_rcu(&f->list, &c->filter.list);
+    spin_unlock_bh(&c->lock);
     ret = 0;
   }
   // Return NULL on success; negative on error
@@ -200,7 +333,25 @@ rtap_filter_add(struct rtap_chain* c, struct rtap_filter* f)
 static int
 rtap_filter_clear(struct rtap_filter* chain)
 {
+  struct rtap_filter* f = NULL;
+  struct rtap_filter* tmp = NULL;
+  LIST_HEAD(dead);
   int ret = 0;
+
+  lockdep_assert_held(&rtap_chains_mutex);
+
+  // Unlink every filter at once and wait out readers still on them
+  list_splice_init_rcu(&chain->list, &dead, rtap_chains_sync);
+
+  // Nothing can reach the filters now; release programs, sets and tables
+  list_for_each_entry_safe(f, tmp, &dead, list)
+  {
+    list_del(&f->list);
+    rtap_filter_destroy(f);
+    ret++;
+  } // end loop
+
+  // Return number of filters destroyed
   return (ret);
 }
 
@@ -254,7 +405,7 @@ static int
 rtap_filter_set_type(struct rtap_filter* f, rtap_filter_type_t type)
 {
   int ret = -1;
-  if (f && type)
+  if (f && type && (type < FILTER_TYPE_LAST))
   {
     f->type = type;
     ret = 0;
@@ -372,12 +523,404 @@ rtap_filter_set_arg(struct rtap_filter* f, const char* arg)
   int ret = -1;
   if (f && arg)
   {
-    strncpy(f->arg, arg, 256);
-    ret = 0;
+    kfree(f->arg);
+    f->arg = kstrndup(arg, RTAP_FILTER_ARG_MAX, GFP_KERNEL);
+    ret = (f->arg ? 0 : -1);
   }
   return(ret);
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct bpf_prog*
+rtap_filter_bpf_classic(const char* arg)
+{
+  struct bpf_prog* prog = NULL;
+  struct sock_fprog_kern fprog = { 0 };
+  struct sock_filter* insns = NULL;
+  const char* p = arg;
+  int len = 0;
+  int i = 0;
+
+  // Same text form as 'tcpdump -ddd' joined with commas (as used by xt_bpf)
+  if ((sscanf(p, "%d", &len) != 1) || (len <= 0) || (len > BPF_MAXINSNS))
+  {
+    printk( KERN_ERR "RTAP: Invalid BPF program length\n");
+    return (NULL);
+  }
+
+  insns = kcalloc(len, sizeof(struct sock_filter), GFP_KERNEL);
+  if (!insns)
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate memory\n");
+    return (NULL);
+  }
+
+  for (i = 0; i < len; i++)
+  {
+    p = strchr(p, ',');
+    if (!p || (sscanf(++p, "%hu %hhu %hhu %u", &insns[i].code, &insns[i].jt,
+        &insns[i].jf, &insns[i].k) != 4))
+    {
+      printk( KERN_ERR "RTAP: Invalid BPF instruction: %d\n", i);
+      kfree(insns);
+      return (NULL);
+    }
+  } // end loop
+
+  // Validates, converts and JITs the program; instructions are copied
+  fprog.len = len;
+  fprog.filter = insns;
+  if (bpf_prog_create(&prog, &fprog))
+  {
+    printk( KERN_ERR "RTAP: BPF program rejected\n");
+    prog = NULL;
+  }
+  kfree(insns);
+
+  return (prog);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct bpf_prog*
+rtap_filter_bpf_ebpf(const char* arg)
+{
+  struct bpf_prog* prog = NULL;
+  int fd = -1;
+
+  // Descriptor belongs to the process writing the proc file
+  if (kstrtoint(arg, 10, &fd) || (fd < 0))
+  {
+    printk( KERN_ERR "RTAP: Invalid BPF program descriptor: %s\n", arg);
+    return (NULL);
+  }
+
+  prog = bpf_prog_get_type(fd, BPF_PROG_TYPE_SOCKET_FILTER);
+  if (IS_ERR(prog))
+  {
+    printk( KERN_ERR "RTAP: Cannot get socket filter program: %d\n", fd);
+    return (NULL);
+  }
+
+  // Frames are shared with the stack; programs may not scribble on skb->cb
+  if (prog->cb_access)
+  {
+    printk( KERN_ERR "RTAP: BPF programs accessing skb->cb not supported\n");
+    bpf_prog_put(prog);
+    return (NULL);
+  }
+
+  return (prog);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_all_compile(struct rtap_filter* f, const char* arg)
+{
+  u32 size = 0;
+
+  if ((f->subtype != FILTER_SUBTYPE_ALL_ALL) && kstrtou32(arg, 0, &size))
+  {
+    printk( KERN_ERR "RTAP: Invalid size: %s\n", arg);
+    return (-1);
+  }
+
+  // Every size comparison becomes an inclusive range
+  f->op.len.min = 0;
+  f->op.len.max = UINT_MAX;
+  switch (f->subtype)
+  {
+  case FILTER_SUBTYPE_ALL_ALL:
+    break;
+  case FILTER_SUBTYPE_ALL_SIZE_EQ:
+    f->op.len.min = f->op.len.max = size;
+    break;
+  case FILTER_SUBTYPE_ALL_SIZE_GE:
+    f->op.len.min = size;
+    break;
+  case FILTER_SUBTYPE_ALL_SIZE_LE:
+    f->op.len.max = size;
+    break;
+  default:
+    return (-1);
+  }
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_radiotap_compile(struct rtap_filter* f, const char* arg)
+{
+  u16 val = 0;
+  u16 mask = 0;
+  bool bad = false;
+  int cnt = 0;
+
+  switch (f->subtype)
+  {
+  case FILTER_SUBTYPE_RTAP_CHANFLAGS:
+    // All of the given flags by default
+    cnt = sscanf(arg, "%hx/%hx", &val, &mask);
+    if (cnt < 1)
+    {
+      printk( KERN_ERR "RTAP: Invalid channel flags: %s\n", arg);
+      return (-1);
+    }
+    f->op.fctl.mask = ((cnt == 2) ? mask : val);
+    f->op.fctl.val = val & f->op.fctl.mask;
+    break;
+  case FILTER_SUBTYPE_RTAP_BADFCS:
+    if (kstrtobool(arg, &bad))
+    {
+      printk( KERN_ERR "RTAP: Invalid FCS state: %s\n", arg);
+      return (-1);
+    }
+    f->op.fctl.mask = IEEE80211_RADIOTAP_F_BADFCS;
+    f->op.fctl.val = (bad ? IEEE80211_RADIOTAP_F_BADFCS : 0);
+    break;
+  case FILTER_SUBTYPE_RTAP_DB:
+  case FILTER_SUBTYPE_RTAP_NOISE:
+  case FILTER_SUBTYPE_RTAP_FREQ:
+  case FILTER_SUBTYPE_RTAP_RATE:
+  case FILTER_SUBTYPE_RTAP_MCS:
+  case FILTER_SUBTYPE_RTAP_NSS:
+  case FILTER_SUBTYPE_RTAP_TSFT:
+    // A single value is a lower bound
+    f->op.range.max = S64_MAX;
+    if (sscanf(arg, "%lld %lld", &f->op.range.min, &f->op.range.max) < 1)
+    {
+      printk( KERN_ERR "RTAP: Invalid range: %s\n", arg);
+      return (-1);
+    }
+    break;
+  default:
+    return (-1);
+  }
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_80211_compile(struct rtap_filter* f, const char* arg)
+{
+  u16 val = 0;
+  u16 mask = RTAP_FILTER_FCTL_MASK;
+
+  switch (f->subtype)
+  {
+  case FILTER_SUBTYPE_80211_SA:
+  case FILTER_SUBTYPE_80211_DA:
+  case FILTER_SUBTYPE_80211_TA:
+  case FILTER_SUBTYPE_80211_RA:
+  case FILTER_SUBTYPE_80211_BSSID:
+    if (!mac_pton(arg, f->op.mac))
+    {
+      printk( KERN_ERR "RTAP: Invalid MAC address: %s\n", arg);
+      return (-1);
+    }
+    break;
+  case FILTER_SUBTYPE_80211_FCTL:
+    // Host order value as in the old "0080" beacon examples
+    if (sscanf(arg, "%hx/%hx", &val, &mask) < 1)
+    {
+      printk( KERN_ERR "RTAP: Invalid frame control: %s\n", arg);
+      return (-1);
+    }
+    f->op.fctl.val = val & mask;
+    f->op.fctl.mask = mask;
+    break;
+  default:
+    return (-1);
+  }
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_filter_ie_free(struct rtap_filter_ie* ie)
+{
+  if (ie)
+  {
+    kfree(ie->buckets);
+    kfree(ie->ssids);
+    kfree(ie->ouis);
+    kfree(ie);
+  }
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct rtap_filter_ie*
+rtap_filter_ie_compile(rtap_filter_subtype_t subtype, char* arg)
+{
+  struct rtap_filter_ie* ie = NULL;
+  struct rtap_filter_ssid* e = NULL;
+  u32 front = 0;
+  u32 back = 0;
+  u32 i = 0;
+  char* tok = NULL;
+  size_t len = 0;
+  u8 id = 0;
+  int cnt = 0;
+
+  ie = kzalloc(sizeof(struct rtap_filter_ie), GFP_KERNEL);
+  if (!ie)
+  {
+    return (NULL);
+  } // end if
+  ie->n = 1;
+  for (i = 0; arg[i]; i++)
+  {
+    ie->n += (arg[i] == ',');
+  } // end loop
+
+  switch (subtype)
+  {
+  case FILTER_SUBTYPE_IE_SSID:
+    ie->hmask = roundup_pow_of_two(ie->n) - 1;
+    ie->buckets = kcalloc(ie->hmask + 1, sizeof(struct hlist_head), GFP_KERNEL);
+    ie->ssids = kcalloc(ie->n, sizeof(struct rtap_filter_ssid), GFP_KERNEL);
+    if (!ie->buckets || !ie->ssids)
+    {
+      goto fail;
+    }
+    back = ie->n;
+    while ((tok = strsep(&arg, ",")))
+    {
+      // A trailing '*' makes a prefix; those fill the array from the front
+      len = strlen(tok);
+      if (len && (tok[len - 1] == '*'))
+      {
+        e = &ie->ssids[front++];
+        len--;
+      }
+      else
+      {
+        e = &ie->ssids[--back];
+        INIT_HLIST_NODE(&e->node);
+        hlist_add_head(&e->node, &ie->buckets[jhash(tok, len, 0) & ie->hmask]);
+      }
+      if (len > IEEE80211_MAX_SSID_LEN)
+      {
+        goto fail;
+      }
+      e->len = len;
+      memcpy(e->ssid, tok, len);
+    } // end loop
+    ie->nprefix = front;
+    break;
+  case FILTER_SUBTYPE_IE_ID:
+    while ((tok = strsep(&arg, ",")))
+    {
+      if (kstrtou8(strim(tok), 0, &id))
+      {
+        goto fail;
+      }
+      set_bit(id, ie->ids);
+    } // end loop
+    break;
+  case FILTER_SUBTYPE_IE_VENDOR:
+    ie->ouis = kcalloc(ie->n, sizeof(struct rtap_filter_oui), GFP_KERNEL);
+    if (!ie->ouis)
+    {
+      goto fail;
+    }
+    for (i = 0; (tok = strsep(&arg, ",")); i++)
+    {
+      struct rtap_filter_oui* o = &ie->ouis[i];
+      cnt = sscanf(tok, "%hhx:%hhx:%hhx:%hhx", &o->oui[0], &o->oui[1], &o->oui[2], &o->type);
+      if (cnt < 3)
+      {
+        goto fail;
+      }
+      o->any = (cnt == 3);
+    } // end loop
+    break;
+  default:
+    goto fail;
+  }
+
+  return (ie);
+
+fail:
+  rtap_filter_ie_free(ie);
+  return (NULL);
+}
+
+/******************************************************************************
+ * Turns the textual filter argument into whatever the matcher needs at run
+ * time so nothing has to be parsed per frame.
+ ******************************************************************************/
+static int
+rtap_filter_compile(struct rtap_filter* f, const char* arg)
+{
+  char* str = NULL;
+  int ret = 0;
+  switch (f->type)
+  {
+  case FILTER_TYPE_ALL:
+    ret = rtap_filter_all_compile(f, arg);
+    break;
+  case FILTER_TYPE_IE:
+    // Split in place on a copy; the text is kept for display
+    str = kstrdup(arg, GFP_KERNEL);
+    if (str)
+    {
+      f->op.ie = rtap_filter_ie_compile(f->subtype, str);
+      kfree(str);
+    }
+    if (!f->op.ie)
+    {
+      printk( KERN_ERR "RTAP: Invalid element list: %s\n", arg);
+    }
+    ret = (f->op.ie ? 0 : -1);
+    break;
+  case FILTER_TYPE_BPF:
+    if (f->subtype == FILTER_SUBTYPE_BPF_CLASSIC)
+    {
+      f->op.prog = rtap_filter_bpf_classic(arg);
+    }
+    else if (f->subtype == FILTER_SUBTYPE_BPF_EBPF)
+    {
+      f->op.prog = rtap_filter_bpf_ebpf(arg);
+    }
+    ret = (f->op.prog ? 0 : -1);
+    break;
+  case FILTER_TYPE_RADIOTAP:
+    ret = rtap_filter_radiotap_compile(f, arg);
+    break;
+  case FILTER_TYPE_80211:
+    ret = rtap_filter_80211_compile(f, arg);
+    break;
+  case FILTER_TYPE_MACSET:
+  case FILTER_TYPE_MACPREFIX:
+    // Any address role; the set itself is filled in through its proc file
+    if ((f->subtype >= ARRAY_SIZE(rtap_filter_80211_role)) ||
+        (rtap_filter_80211_role[f->subtype] == RTAP_ADDR_LAST))
+    {
+      return (-1);
+    }
+    f->op.set = rtap_macset_get(arg);
+    ret = (f->op.set ? 0 : -1);
+    break;
+  default:
+    break;
+  }
+  return (ret);
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -423,6 +966,7 @@ rtap_chain_create(void)
   memset((void *) c->name, 0, 32);
 
   // Initialize chain structure
+  spin_lock_init(&c->lock);
   spin_lock_init(&c->filter.lock);
   INIT_LIST_HEAD(&c->filter.list);
 
@@ -468,18 +1012,18 @@ rtap_chain_find(const char* name)
 {
   struct rtap_chain* ret = 0;
   struct rtap_chain* chain = 0;
-  struct rtap_chain* tmp = 0;
+
+  // Chains are only freed under the update mutex, so the result stays valid
+  lockdep_assert_held(&rtap_chains_mutex);
 
   // Search for specified filter chain in list
-  spin_lock(&rtap_chains.lock);
-  list_for_each_entry_safe(chain, tmp, &rtap_chains.list, list)
+  list_for_each_entry(chain, &rtap_chains.list, list)
   {
     if( ! strcmp( chain->name, name) )
     {
       ret = chain;
     }
   } // end loop
-  spin_unlock(&rtap_chains.lock);
 
   return (ret);
 }
@@ -488,191 +1032,583 @@ rtap_chain_find(const char* name)
  *
  ******************************************************************************/
 static int
-rtap_chain_remove(const char* name)
+rtap_chain_remove(const char* name)
+{
+  int ret = 0;
+  struct rtap_chain *chain = 0;
+
+  lockdep_assert_held(&rtap_chains_mutex);
+
+  // Search for specified filter chain in list
+  chain = rtap_chain_find(name);
+  if (chain)
+  {
+    // Unlink specified filter chain; readers may still be walking it
+    printk( KERN_INFO "RTAP: Removing filter chain: %s\n", chain->name );
+    spin_lock_bh(&rtap_chains.lock);
+    list_del_rcu( &chain->list );
+    spin_unlock_bh(&rtap_chains.lock);
+    synchronize_srcu(&rtap_chains_srcu);
+    rtap_filter_clear( &chain->filter );
+    rtap_chain_destroy( chain );
+  }
+
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_chain_add(struct rtap_chain* chain)
+{
+
+  // Add filter chain to tail of filter chain list
+  spin_lock_bh(&rtap_chains.lock);
+  list_add_tail_rcu(&chain->list, &rtap_chains.list);
+  spin_unlock_bh(&rtap_chains.lock);
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_chain_clear(void)
+{
+
+  struct rtap_chain *chain = 0;
+  struct rtap_chain *tmp = 0;
+  LIST_HEAD(dead);
+
+  lockdep_assert_held(&rtap_chains_mutex);
+
+  // Unlink all filter chains at once and wait out readers still on them
+  list_splice_init_rcu(&rtap_chains.list, &dead, rtap_chains_sync);
+
+  list_for_each_entry_safe(chain, tmp, &dead, list)
+  {
+    printk( KERN_INFO "RTAP: Removing filter chain\n");
+    list_del( &chain->list );
+    rtap_filter_clear( &chain->filter );
+    rtap_chain_destroy( chain );
+  } // end loop
+
+  return (1);
+
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_filter_summarize_one(struct rtap_filter* f, struct rtap_filter_summary* s)
+{
+  unsigned int len_min = 0;
+  unsigned int len_max = UINT_MAX;
+  u64 fctl = 0;
+  int b = 0;
+
+  // Mirror what each matcher accepts; types without a matcher add nothing
+  switch (f->type)
+  {
+  case FILTER_TYPE_ALL:
+    fctl = RTAP_FILTER_FCTL_ALL;
+    len_min = f->op.len.min;
+    len_max = f->op.len.max;
+    break;
+  case FILTER_TYPE_RADIOTAP:
+  case FILTER_TYPE_BPF:
+  case FILTER_TYPE_MACSET:
+  case FILTER_TYPE_MACPREFIX:
+    fctl = RTAP_FILTER_FCTL_ALL;
+    break;
+  case FILTER_TYPE_IE:
+    // Only management frames that carry elements get scanned
+    fctl = RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_BEACON)) |
+        RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_PROBE_REQ)) |
+        RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_PROBE_RESP)) |
+        RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_ASSOC_REQ)) |
+        RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_ASSOC_RESP)) |
+        RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_REASSOC_REQ)) |
+        RTAP_FILTER_FCTL_BIT(cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_REASSOC_RESP));
+    break;
+  case FILTER_TYPE_80211:
+    if (f->subtype != FILTER_SUBTYPE_80211_FCTL)
+    {
+      // Addresses show up in every frame type
+      fctl = RTAP_FILTER_FCTL_ALL;
+      break;
+    }
+    // Every type/subtype the value and mask leave open; other bits ignored
+    for (b = 0; b < 64; b++)
+    {
+      if (((b << 2) & f->op.fctl.mask & RTAP_FILTER_FCTL_MASK) ==
+          (f->op.fctl.val & RTAP_FILTER_FCTL_MASK))
+      {
+        fctl |= (1ULL << b);
+      }
+    } // end loop
+    break;
+  default:
+    return;
+  }
+
+  s->fctl |= fctl;
+  s->len_min = min(s->len_min, len_min);
+  s->len_max = max(s->len_max, len_max);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_filter_summarize(void)
+{
+  struct rtap_filter_summary* s = NULL;
+  struct rtap_filter_summary* old = NULL;
+  struct rtap_chain* c = NULL;
+  struct rtap_filter* f = NULL;
+
+  // A missing summary lets every frame through, so failing here is safe
+  s = kzalloc(sizeof(struct rtap_filter_summary), GFP_KERNEL);
+  if (s)
+  {
+    s->len_min = UINT_MAX;
+    s->len_max = 0;
+  }
+
+  lockdep_assert_held(&rtap_chains_mutex);
+
+  spin_lock_bh(&rtap_chains.lock);
+  if (s)
+  {
+    list_for_each_entry(c, &rtap_chains.list, list)
+    {
+      list_for_each_entry(f, &c->filter.list, list)
+      {
+        rtap_filter_summarize_one(f, s);
+      } // end loop
+    } // end loop
+  }
+  old = rcu_dereference_protected(rtap_filter_summary,
+      lockdep_is_held(&rtap_chains.lock));
+  rcu_assign_pointer(rtap_filter_summary, s);
+  spin_unlock_bh(&rtap_chains.lock);
+
+  if (old)
+  {
+    kfree_rcu(old, rcu);
+  }
+}
+
+//*****************************************************************************
+// Filter Functions
+//*****************************************************************************
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_all(struct rtap_filter *f, struct rtap_frame *frame)
+{
+  int ret = -1;
+  if (f && (f->type == FILTER_TYPE_ALL) && frame)
+  {
+    // Every subtype was compiled to a length range
+    unsigned int len = frame->skb->len;
+    if ((len >= f->op.len.min) && (len <= f->op.len.max))
+    {
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
+    }
+  }
+  return(ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_radiotap(struct rtap_filter *f, struct rtap_frame *frame)
+{
+  int ret = -1;
+  if (f && (f->type == FILTER_TYPE_RADIOTAP) && frame)
+  {
+    const struct rtap_frame_rtfields* rt = rtap_device_get_rtfields(frame);
+    u32 field = 0;
+    u32 flags = 0;
+    s64 val = 0;
+    bool match = false;
+
+    switch (f->subtype)
+    {
+    case FILTER_SUBTYPE_RTAP_DB:
+      field = IEEE80211_RADIOTAP_DBM_ANTSIGNAL;
+      val = rt->signal;
+      break;
+    case FILTER_SUBTYPE_RTAP_NOISE:
+      field = IEEE80211_RADIOTAP_DBM_ANTNOISE;
+      val = rt->noise;
+      break;
+    case FILTER_SUBTYPE_RTAP_FREQ:
+      field = IEEE80211_RADIOTAP_CHANNEL;
+      val = rt->freq;
+      break;
+    case FILTER_SUBTYPE_RTAP_CHANFLAGS:
+      field = IEEE80211_RADIOTAP_CHANNEL;
+      flags = rt->chanflags;
+      break;
+    case FILTER_SUBTYPE_RTAP_RATE:
+      field = IEEE80211_RADIOTAP_RATE;
+      val = rt->rate;
+      break;
+    case FILTER_SUBTYPE_RTAP_MCS:
+      field = IEEE80211_RADIOTAP_MCS;
+      val = rt->mcs;
+      break;
+    case FILTER_SUBTYPE_RTAP_NSS:
+      field = IEEE80211_RADIOTAP_VHT;
+      val = rt->nss;
+      break;
+    case FILTER_SUBTYPE_RTAP_BADFCS:
+      field = IEEE80211_RADIOTAP_FLAGS;
+      flags = rt->flags;
+      break;
+    case FILTER_SUBTYPE_RTAP_TSFT:
+      field = IEEE80211_RADIOTAP_TSFT;
+      val = rt->tsft;
+      break;
+    default:
+      return (ret);
+    }
+
+    // Frames without the field never match
+    if (rt->have & BIT(field))
+    {
+      if ((f->subtype == FILTER_SUBTYPE_RTAP_CHANFLAGS) ||
+          (f->subtype == FILTER_SUBTYPE_RTAP_BADFCS))
+      {
+        match = ((flags & f->op.fctl.mask) == f->op.fctl.val);
+      }
+      else
+      {
+        match = ((val >= f->op.range.min) && (val <= f->op.range.max));
+      }
+    }
+
+    if (match)
+    {
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
+    }
+  }
+  return(ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_80211(struct rtap_filter *f, struct rtap_frame *frame)
+{
+  int ret = -1;
+  if (f && (f->type == FILTER_TYPE_80211) && frame)
+  {
+    const struct rtap_frame_desc* desc = rtap_device_get_desc(frame);
+    const u8* addr = NULL;
+    bool match = false;
+
+    switch (f->subtype)
+    {
+    case FILTER_SUBTYPE_80211_SA:
+    case FILTER_SUBTYPE_80211_DA:
+    case FILTER_SUBTYPE_80211_TA:
+    case FILTER_SUBTYPE_80211_RA:
+    case FILTER_SUBTYPE_80211_BSSID:
+      addr = rtap_frame_desc_addr(desc, rtap_filter_80211_role[f->subtype]);
+      match = (addr && ether_addr_equal(addr, f->op.mac));
+      break;
+    case FILTER_SUBTYPE_80211_FCTL:
+      match = (desc->hdrlen &&
+          ((le16_to_cpu(desc->fctl) & f->op.fctl.mask) == f->op.fctl.val));
+      break;
+    default:
+      break;
+    }
+
+    if (match)
+    {
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
+    }
+  }
+  return(ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_ip(struct rtap_filter *f, struct rtap_frame *frame)
+{
+  int ret = -1;
+  if (f && (f->type == FILTER_TYPE_IP) && frame)
+  {
+    switch (f->subtype)
+    {
+    default:
+      break;
+    }
+  }
+  return(ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_bpf(struct rtap_filter *f, struct rtap_frame *frame)
+{
+  int ret = -1;
+  u32 match = 0;
+  if (f && (f->type == FILTER_TYPE_BPF) && f->op.prog && frame)
+  {
+    // Program sees the frame from the radiotap header on; non-zero matches.
+    // Workers are preemptible and only hold the chain SRCU, but map helpers
+    // need RCU and a fixed CPU, as in sk_filter_trim_cap()
+    rcu_read_lock();
+    preempt_disable();
+    match = BPF_PROG_RUN(f->op.prog, frame->skb);
+    preempt_enable();
+    rcu_read_unlock();
+    if (match)
+    {
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
+    }
+  }
+  return(ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_macset(struct rtap_filter *f, struct rtap_frame *frame)
+{
+  int ret = -1;
+  if (f && (f->type == FILTER_TYPE_MACSET) && frame)
+  {
+    const struct rtap_frame_desc* desc = rtap_device_get_desc(frame);
+    const u8* addr = rtap_frame_desc_addr(desc, rtap_filter_80211_role[f->subtype]);
+
+    // One hash lookup however many addresses the set holds
+    if (addr && rtap_macset_contains(f->op.set, addr))
+    {
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
+    }
+  }
+  return(ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_filter_macprefix(struct rtap_filter *f, struct rtap_frame *frame)
 {
-  int ret = 0;
-  struct rtap_chain *chain = 0;
-  struct rtap_chain *tmp = 0;
-
-  // Search for specified filter chain in list
-  spin_lock(&rtap_chains.lock);
-  list_for_each_entry_safe(chain, tmp, &rtap_chains.list, list)
+  int ret = -1;
+  if (f && (f->type == FILTER_TYPE_MACPREFIX) && frame)
   {
-    if( ! strcmp( chain->name, name) )
+    const struct rtap_frame_desc* desc = rtap_device_get_desc(frame);
+    const u8* addr = rtap_frame_desc_addr(desc, rtap_filter_80211_role[f->subtype]);
+
+    if (addr && rtap_macset_contains_prefix(f->op.set, addr))
     {
-      // Remove specified filter chain from list
-      printk( KERN_INFO "RTAP: Removing filter chain: %s\n", chain->name );
-      rtap_filter_clear( &chain->filter );
-      list_del( &chain->list );
-      kfree( chain->name );
-      chain->name = 0;
-      kfree( chain );
-      break;
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
     }
-  } // end loop
-  spin_unlock(&rtap_chains.lock);
+  }
+  return(ret);
+}
 
-  return (ret);
+/******************************************************************************
+ * Length of the fixed fields ahead of the elements, or -1 if the frame has
+ * no elements worth scanning.
+ ******************************************************************************/
+static int
+rtap_filter_ie_fixed(__le16 fc)
+{
+  if (ieee80211_is_beacon(fc) || ieee80211_is_probe_resp(fc))
+  {
+    return (12); // Timestamp, interval, capabilities
+  }
+  if (ieee80211_is_probe_req(fc))
+  {
+    return (0);
+  }
+  if (ieee80211_is_assoc_req(fc))
+  {
+    return (4); // Capabilities, listen interval
+  }
+  if (ieee80211_is_reassoc_req(fc))
+  {
+    return (10); // Capabilities, listen interval, current AP
+  }
+  if (ieee80211_is_assoc_resp(fc) || ieee80211_is_reassoc_resp(fc))
+  {
+    return (6); // Capabilities, status, AID
+  }
+  return (-1);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static int
-rtap_chain_add(struct rtap_chain* chain)
+static bool
+rtap_filter_ie_ssid(const struct rtap_filter_ie* ie, const u8* ssid, u8 len)
 {
+  const struct rtap_filter_ssid* e = NULL;
+  u32 i = 0;
 
-  // Add filter chain to tail of filter chain list
-  spin_lock(&rtap_chains.lock);
-  list_add_tail(&chain->list, &rtap_chains.list);
-  spin_unlock(&rtap_chains.lock);
+  hlist_for_each_entry(e, &ie->buckets[jhash(ssid, len, 0) & ie->hmask], node)
+  {
+    if ((e->len == len) && !memcmp(e->ssid, ssid, len))
+    {
+      return (true);
+    }
+  } // end loop
+  for (i = 0; i < ie->nprefix; i++)
+  {
+    e = &ie->ssids[i];
+    if ((e->len <= len) && !memcmp(e->ssid, ssid, e->len))
+    {
+      return (true);
+    }
+  } // end loop
 
-  return (0);
+  return (false);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
-static int
-rtap_chain_clear(void)
+static bool
+rtap_filter_ie_vendor(const struct rtap_filter_ie* ie, const u8* body, u8 len)
 {
+  const struct rtap_filter_oui* o = NULL;
+  u32 i = 0;
 
-  struct rtap_chain *chain = 0;
-  struct rtap_chain *tmp = 0;
-
-  // Remove all filter chains from list
-  spin_lock(&rtap_chains.lock);
-  list_for_each_entry_safe(chain, tmp, &rtap_chains.list, list)
+  for (i = 0; i < ie->n; i++)
   {
-    printk( KERN_INFO "RTAP: Removing filter chain\n");
-    rtap_filter_clear( &chain->filter );
-    list_del( &chain->list );
-    if (chain->name)
+    o = &ie->ouis[i];
+    if (!memcmp(o->oui, body, sizeof(o->oui)) && (o->any || ((len > 3) && (body[3] == o->type))))
     {
-      kfree( chain->name );
-      chain->name = 0;
+      return (true);
     }
-    kfree( chain );
   } // end loop
-  spin_unlock(&rtap_chains.lock);
-
-  return (1);
 
+  return (false);
 }
 
-//*****************************************************************************
-// Filter Functions
-//*****************************************************************************
-
 /******************************************************************************
- *
+ * Walks the element chain of a management frame up to the first element
+ * that decides the match; a length running past the frame ends the walk.
  ******************************************************************************/
-static int
-rtap_filter_all(struct rtap_filter *f, struct sk_buff *skb)
+static bool
+rtap_filter_ie_scan(struct rtap_filter* f, struct rtap_frame* frame)
 {
-  int ret = -1;
-  if (f && (f->type == FILTER_TYPE_ALL) && skb)
+  const struct rtap_frame_desc* desc = rtap_device_get_desc(frame);
+  const struct rtap_filter_ie* ie = f->op.ie;
+  const struct sk_buff* skb = frame->skb;
+  const u8* h = NULL;
+  const u8* b = NULL;
+  u8 hbuf[2];
+  u8 bbuf[IEEE80211_MAX_SSID_LEN];
+  unsigned int pos = 0;
+  unsigned int end = skb->len;
+  int fixed = 0;
+
+  if (!desc->hdrlen || !ieee80211_is_mgmt(desc->fctl))
   {
-    switch (f->subtype)
-    {
+    return (false);
+  }
+  fixed = rtap_filter_ie_fixed(desc->fctl);
+  if (fixed < 0)
+  {
+    return (false);
+  }
+  pos = desc->payload + fixed;
 
-    case FILTER_SUBTYPE_ALL_ALL:
-      f->count++;
-      ret = rtap_rule_invoke(f->rule, skb);
-      break;
+  // Trailing FCS is not an element
+  if (rtap_device_get_rtfields(frame)->flags & IEEE80211_RADIOTAP_F_FCS)
+  {
+    end -= min_t(unsigned int, end, FCS_LEN);
+  }
 
-    case FILTER_SUBTYPE_ALL_SIZE_EQ:
+  while ((pos + 2) <= end)
+  {
+    h = skb_header_pointer(skb, pos, sizeof(hbuf), hbuf);
+    if (!h || ((pos + 2 + h[1]) > end))
     {
-      int size = 0;
-      int cnt = sscanf(f->arg, "%d", &size);
-      if ((cnt == 1) && (skb->len == size))
-      {
-        f->count++;
-        ret = rtap_rule_invoke(f->rule, skb);
-      }
       break;
     }
-
-    case FILTER_SUBTYPE_ALL_SIZE_GE:
+    switch (f->subtype)
     {
-      int size = 0;
-      int cnt = sscanf(f->arg, "%d", &size);
-      if ((cnt == 1) && (skb->len >= size))
+    case FILTER_SUBTYPE_IE_SSID:
+      // Only the first SSID element counts
+      if (h[0] == WLAN_EID_SSID)
       {
-        f->count++;
-        ret = rtap_rule_invoke(f->rule, skb);
+        if (h[1] > IEEE80211_MAX_SSID_LEN)
+        {
+          return (false);
+        }
+        b = skb_header_pointer(skb, pos + 2, h[1], bbuf);
+        return (b && rtap_filter_ie_ssid(ie, b, h[1]));
       }
       break;
-    }
-
-    case FILTER_SUBTYPE_ALL_SIZE_LE:
-    {
-      int size = 0;
-      int cnt = sscanf(f->arg, "%d", &size);
-      if ((cnt == 1) && (skb->len <= size))
+    case FILTER_SUBTYPE_IE_ID:
+      if (test_bit(h[0], ie->ids))
       {
-        f->count++;
-        ret = rtap_rule_invoke(f->rule, skb);
+        return (true);
       }
       break;
-    }
-
-    default:
+    case FILTER_SUBTYPE_IE_VENDOR:
+      // OUI and vendor specific type
+      if ((h[0] == WLAN_EID_VENDOR_SPECIFIC) && (h[1] >= 3))
+      {
+        b = skb_header_pointer(skb, pos + 2, min_t(u8, h[1], 4), bbuf);
+        if (b && rtap_filter_ie_vendor(ie, b, min_t(u8, h[1], 4)))
+        {
+          return (true);
+        }
+      }
       break;
-    }
-  }
-  return(ret);
-}
-
-/******************************************************************************
- *
- ******************************************************************************/
-static int
-rtap_filter_radiotap(struct rtap_filter *f, struct sk_buff *skb)
-{
-  int ret = -1;
-  if (f && (f->type == FILTER_TYPE_RADIOTAP) && skb)
-  {
-    switch (f->subtype)
-    {
     default:
-      break;
+      return (false);
     }
-  }
-  return(ret);
-}
+    pos += 2 + h[1];
+  } // end loop
 
-/******************************************************************************
- *
- ******************************************************************************/
-static int
-rtap_filter_80211(struct rtap_filter *f, struct sk_buff *skb)
-{
-  int ret = -1;
-  if (f && (f->type == FILTER_TYPE_80211) && skb)
-  {
-    switch (f->subtype)
-    {
-    default:
-      break;
-    }
-  }
-  return(ret);
+  return (false);
 }
 
 /******************************************************************************
  *
  ******************************************************************************/
 static int
-rtap_filter_ip(struct rtap_filter *f, struct sk_buff *skb)
+rtap_filter_ie(struct rtap_filter *f, struct rtap_frame *frame)
 {
   int ret = -1;
-  if (f && (f->type == FILTER_TYPE_IP) && skb)
+  if (f && (f->type == FILTER_TYPE_IE) && f->op.ie && frame)
   {
-    switch (f->subtype)
+    if (rtap_filter_ie_scan(f, frame))
     {
-    default:
-      break;
+      f->count++;
+      ret = rtap_rule_invoke(f->rule, frame);
     }
   }
   return(ret);
@@ -686,38 +1622,77 @@ rtap_filter_ip(struct rtap_filter *f, struct sk_buff *skb)
  *
  ******************************************************************************/
 int
-rtap_filter_recv(struct sk_buff *skb)
+rtap_filter_recv(struct rtap_frame *frame)
 {
 
   struct rtap_chain *c = NULL;
-  struct rtap_chain *tmp_c = NULL;
   struct rtap_filter* f = NULL;
-  struct rtap_filter* tmp_f = NULL;
-  struct sk_buff* skb_cloned = 0;
+  int idx = 0;
 
 //  printk( KERN_INFO "RTAP: Received by filter\n");
 
-  // Clone socket buffer before messing with it
-  skb_cloned = skb_clone(skb, GFP_ATOMIC);
-
-  // Loop through all rtap_filters
-  spin_lock(&rtap_chains.lock);
-  list_for_each_entry_safe(c, tmp_c, &rtap_chains.list, list)
+  // Loop through all rtap_filters; filters only read the frame. No lock is
+  // taken so workers do not serialize, and rules may sleep in listener_send.
+  idx = srcu_read_lock(&rtap_chains_srcu);
+  list_for_each_entry_rcu(c, &rtap_chains.list, list)
   {
-    list_for_each_entry_safe(f, tmp_f, &c->filter.list, list)
+    list_for_each_entry_rcu(f, &c->filter.list, list)
     {
-      rtap_filtertbl[f->type]( f, skb_cloned );
+      if (rtap_filtertbl[f->type])
+      {
+        rtap_filtertbl[f->type]( f, frame );
+      }
     }
   } // end loop
-  spin_unlock(&rtap_chains.lock);
-
-  // Free cloned socket buffer
-  kfree_skb(skb_cloned);
+  srcu_read_unlock(&rtap_chains_srcu, idx);
 
   // Return success
   return (0);
 }
 
+/******************************************************************************
+ * Waits until no frame is still being run through the filters, including
+ * the rules and listener sends they invoke.
+ ******************************************************************************/
+void
+rtap_filter_sync(void)
+{
+  rtap_chains_sync();
+}
+
+/******************************************************************************
+ * Returns false only if no active filter can possibly match a frame of the
+ * given length and frame control; safe to call from softirq context.
+ ******************************************************************************/
+bool
+rtap_filter_prematch(unsigned int len, const __le16 *fctl)
+{
+  const struct rtap_filter_summary* s = NULL;
+  bool ret = true;
+
+  rcu_read_lock();
+  s = rcu_dereference(rtap_filter_summary);
+  if (s)
+  {
+    if ((len < s->len_min) || (len > s->len_max))
+    {
+      ret = false;
+    }
+    else if (fctl)
+    {
+      ret = !!(s->fctl & RTAP_FILTER_FCTL_BIT(*fctl));
+    }
+    else
+    {
+      // No 802.11 header; only filters that ignore frame control can match
+      ret = (s->fctl == RTAP_FILTER_FCTL_ALL);
+    }
+  }
+  rcu_read_unlock();
+
+  return (ret);
+}
+
 #if 0
 //*****************************************************************************
 
@@ -739,66 +1714,6 @@ rtap_filter_radiotap( struct rtap_filter *f, struct sk_buff *skb )
 
 //*****************************************************************************
 
-rtap_filter_cmd_t
-rtap_filter_80211_mac( struct rtap_filter *fp, struct sk_buff *skb )
-{
-  rtap_filter_cmd_t ret_cmd = FILTER_CMD_NONE;
-  struct ieee80211_radiotap_header *rthdr =
-  (struct ieee80211_radiotap_header *)skb->data;
-  struct ieee80211_hdr *fhdr =
-  (struct ieee80211_hdr *)((uint8_t *)rthdr + cpu_to_le16( rthdr->it_len ) );
-  uint8_t mac[6] =
-  { 0};
-  uint16_t fctl = 0;
-
-  switch( fp->rid )
-  {
-    case RULE_ID_MAC_SA:
-    // Convert mac string to binary
-    sscanf( fp->arg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-        &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
-    //printk( KERN_INFO "RTAP: SA(exp): %02x:%02x:%02x:%02x:%02x:%02x\n",
-    //     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    //printk(KERN_INFO "RTAP: SA(obs): %02x:%02x:%02x:%02x:%02x:%02x\n",
-    //         fhdr->addr2[0], fhdr->addr2[1], fhdr->addr2[2],
-    //         fhdr->addr2[3], fhdr->addr2[4], fhdr->addr2[5]);
-    if( ! memcmp( fhdr->addr2, mac, sizeof( fhdr->addr2 ) ) )
-    {
-      ret_cmd = fp->cmd;
-    } // end if
-    break;
-    case RULE_ID_MAC_DA:
-    // Convert mac string to binary
-    sscanf( fp->arg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-        &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
-    //printk(KERN_INFO "RTAP: DA(exp): %02x:%02x:%02x:%02x:%02x:%02x\n",
-    //     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    //printk(KERN_INFO "RTAP: DA(obs): %02x:%02x:%02x:%02x:%02x:%02x\n",
-    //         fhdr->addr1[0], fhdr->addr1[1], fhdr->addr1[2],
-    //         fhdr->addr1[3], fhdr->addr1[4], fhdr->addr1[5]);
-    if( ! memcmp( fhdr->addr1, fp->arg, sizeof( fhdr->addr1 ) ) )
-    {
-      ret_cmd = fp->cmd;
-    } // end if
-    break;
-    case RULE_ID_MAC_FCTL:
-    // Convert fctl string to binary
-    sscanf( fp->arg, "%hx", &fctl );
-    //printk(KERN_INFO "RTAP: FCTL(exp): 0x%04x\n", fctl);
-    //printk(KERN_INFO "RTAP: FCTL(obs): 0x%04x\n", cpu_to_le16(fhdr->frame_control));
-    if( cpu_to_le16( fhdr->frame_control ) == fctl )
-    {
-      ret_cmd = fp->cmd;
-    } // end if
-    break;
-    default:
-    break;
-  }
-  return( ret_cmd );
-}
-
-//*****************************************************************************
-
 static int
 rtap_filter_remove( rtap_filter_id_t fid )
 {
@@ -928,6 +1843,9 @@ rtap_filter_init(void)
 {
   spin_lock_init(&rtap_chains.lock);
   INIT_LIST_HEAD(&rtap_chains.list);
+  mutex_lock(&rtap_chains_mutex);
+  rtap_filter_summarize();
+  mutex_unlock(&rtap_chains_mutex);
   return (0);
 }
 
@@ -937,7 +1855,13 @@ rtap_filter_init(void)
 int
 rtap_filter_exit(void)
 {
-  return (rtap_chain_clear());
+  int ret = 0;
+  mutex_lock(&rtap_chains_mutex);
+  ret = rtap_chain_clear();
+  mutex_unlock(&rtap_chains_mutex);
+  kfree(rcu_dereference_protected(rtap_filter_summary, 1));
+  RCU_INIT_POINTER(rtap_filter_summary, NULL);
+  return (ret);
 }
 
 //*****************************************************************************
@@ -974,6 +1898,18 @@ rtap_filter_type_str(struct rtap_filter* f)
   case FILTER_TYPE_TCP:
     str = "TCP";
     break;
+  case FILTER_TYPE_BPF:
+    str = "BPF";
+    break;
+  case FILTER_TYPE_MACSET:
+    str = "MAC set";
+    break;
+  case FILTER_TYPE_MACPREFIX:
+    str = "MAC prefix";
+    break;
+  case FILTER_TYPE_IE:
+    str = "Element";
+    break;
   default:
     str = "Unknown";
     break;
@@ -1017,10 +1953,88 @@ rtap_filter_subtype_str(struct rtap_filter* f)
   }
   case FILTER_TYPE_RADIOTAP:
   {
+    switch (f->subtype)
+    {
+    case FILTER_SUBTYPE_RTAP_DB:
+      str = "Signal";
+      break;
+    case FILTER_SUBTYPE_RTAP_NOISE:
+      str = "Noise";
+      break;
+    case FILTER_SUBTYPE_RTAP_FREQ:
+      str = "Frequency";
+      break;
+    case FILTER_SUBTYPE_RTAP_CHANFLAGS:
+      str = "Channel flags";
+      break;
+    case FILTER_SUBTYPE_RTAP_RATE:
+      str = "Rate";
+      break;
+    case FILTER_SUBTYPE_RTAP_MCS:
+      str = "HT MCS";
+      break;
+    case FILTER_SUBTYPE_RTAP_NSS:
+      str = "VHT NSS";
+      break;
+    case FILTER_SUBTYPE_RTAP_BADFCS:
+      str = "Bad FCS";
+      break;
+    case FILTER_SUBTYPE_RTAP_TSFT:
+      str = "TSFT";
+      break;
+    default:
+      str = "Unknown";
+      break;
+    }
     break;
   }
   case FILTER_TYPE_80211:
+  case FILTER_TYPE_MACSET:
+  case FILTER_TYPE_MACPREFIX:
+  {
+    switch (f->subtype)
+    {
+    case FILTER_SUBTYPE_80211_SA:
+      str = "Source";
+      break;
+    case FILTER_SUBTYPE_80211_DA:
+      str = "Destination";
+      break;
+    case FILTER_SUBTYPE_80211_TA:
+      str = "Transmitter";
+      break;
+    case FILTER_SUBTYPE_80211_RA:
+      str = "Receiver";
+      break;
+    case FILTER_SUBTYPE_80211_FCTL:
+      str = "Frame control";
+      break;
+    case FILTER_SUBTYPE_80211_BSSID:
+      str = "BSSID";
+      break;
+    default:
+      str = "Unknown";
+      break;
+    }
+    break;
+  }
+  case FILTER_TYPE_IE:
   {
+    switch (f->subtype)
+    {
+    case FILTER_SUBTYPE_IE_SSID:
+      str = "SSID";
+      break;
+    case FILTER_SUBTYPE_IE_ID:
+      str = "Element ID";
+      break;
+    case FILTER_SUBTYPE_IE_VENDOR:
+      str = "Vendor OUI";
+      break;
+    default:
+      str = "Unknown";
+      break;
+    }
     break;
   }
   case FILTER_TYPE_IP:
@@ -1035,6 +2049,22 @@ rtap_filter_subtype_str(struct rtap_filter* f)
   {
     break;
   }
+  case FILTER_TYPE_BPF:
+  {
+    switch (f->subtype)
+    {
+    case FILTER_SUBTYPE_BPF_CLASSIC:
+      str = "Classic";
+      break;
+    case FILTER_SUBTYPE_BPF_EBPF:
+      str = "eBPF";
+      break;
+    default:
+      str = "Unknown";
+      break;
+    }
+    break;
+  }
   default:
     str = "Unknown";
     break;
@@ -1050,26 +2080,23 @@ proc_show(struct seq_file *file, void *arg)
 {
 
   struct rtap_chain* c = NULL;
-  struct rtap_chain* tmp_c = NULL;
   struct rtap_filter* f = NULL;
-  struct rtap_filter* tmp_f = NULL;
+  int idx = 0;
 
   // Iterate over all rtap_filters in list
-  spin_lock(&rtap_chains.lock);
-  list_for_each_entry_safe(c, tmp_c, &rtap_chains.list, list)
+  idx = srcu_read_lock(&rtap_chains_srcu);
+  list_for_each_entry_rcu(c, &rtap_chains.list, list)
   {
     seq_printf( file, "Chain: %s\n", c->name );
     // Iterate over all rtap_filters in list
-    spin_lock( &c->lock );
-    list_for_each_entry_safe( f, tmp_f, &c->filter.list, list )
+    list_for_each_entry_rcu( f, &c->filter.list, list )
     {
       seq_printf( file, "\t[%u]\t%d\t%16s\t%16s\t%d\t%32s\n",
           f->count, f->fid, rtap_filter_type_str(f),
           rtap_filter_subtype_str(f), rtap_filter_get_rule(f), f->arg);
     } // end loop
-    spin_unlock( &c->lock );
   } // end loop
-  spin_unlock(&rtap_chains.lock);
+  srcu_read_unlock(&rtap_chains_srcu, idx);
 
   return (0);
 
@@ -1114,26 +2141,23 @@ proc_lseek(struct file *file, loff_t off, int cnt)
 /******************************************************************************
  *
  ******************************************************************************/
-static ssize_t
-proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
+static int
+rtap_filter_cmd(char* fltrstr)
 {
-  char fltrstr[256 + 1] = { 0 };
   char name[32] = { 0 }; // chain name
   int fid = 0; // filter id
   int type = 0; // filter type
   int rid = 0; // rule id
   int subtype = 0; // filter subtype
-  char arg[256] = { 0 }; // filter argument string
+  char* arg = ""; // filter argument string; remainder of the line
+  int len = 0;
   int ret = 0;
 
-  if (!cnt)
+  ret = sscanf(fltrstr, "%31s %d %d %d %d %n", name, &fid, &type, &rid, &subtype, &len);
+  if ((ret >= 5) && len)
   {
-    return (cnt);
-  } // end if
-
-  cnt = (cnt >= 256) ? 256 : cnt;
-  copy_from_user(fltrstr, buf, cnt);
-  ret = sscanf(fltrstr, "%256s %d %d %d %d %256s", name, &fid, &type, &rid, &subtype, arg);
+    arg = strim(&fltrstr[len]);
+  }
 
   printk( KERN_INFO "RTAP: Filter: %s %d %d %d %d %s", name, fid, type, rid, subtype, arg);
 
@@ -1166,7 +2190,7 @@ proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
     {
       if (rtap_filter_set_id(filter, fid) || rtap_filter_set_type(filter, type) ||
           rtap_filter_set_rule(filter, rid) || rtap_filter_set_subtype(filter, subtype) ||
-          rtap_filter_set_arg(filter, arg))
+          rtap_filter_set_arg(filter, arg) || rtap_filter_compile(filter, arg))
       {
         printk( KERN_ERR "RTAP: Invalid arguments\n");
         rtap_filter_destroy(filter);
@@ -1177,6 +2201,7 @@ proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
     else
     {
       printk( KERN_ERR "RTAP: Failed to add filter\n");
+      rtap_filter_destroy(filter);
       return(-1);
     }
   } // end else if
@@ -1186,6 +2211,50 @@ proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
     return (-1);
   } // end else
 
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static ssize_t
+proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
+{
+  char* fltrstr = NULL;
+  ssize_t ret = 0;
+
+  if (!cnt)
+  {
+    return (cnt);
+  } // end if
+
+  // Large enough for BPF bytecode, so not on the stack
+  cnt = (cnt >= RTAP_FILTER_CMD_MAX) ? (RTAP_FILTER_CMD_MAX - 1) : cnt;
+  fltrstr = kzalloc(RTAP_FILTER_CMD_MAX, GFP_KERNEL);
+  if (!fltrstr)
+  {
+    return (-ENOMEM);
+  } // end if
+  if (copy_from_user(fltrstr, buf, cnt))
+  {
+    kfree(fltrstr);
+    return (-EFAULT);
+  } // end if
+
+  mutex_lock(&rtap_chains_mutex);
+  ret = rtap_filter_cmd(fltrstr);
+  if (!ret)
+  {
+    // Republish what the filters can match for the receive prefilter
+    rtap_filter_summarize();
+  } // end if
+  mutex_unlock(&rtap_chains_mutex);
+  kfree(fltrstr);
+  if (ret)
+  {
+    return (ret);
+  } // end if
+
   // Return number of bytes written
   return (cnt);
 }
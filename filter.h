@@ -47,6 +47,8 @@
 // Type definitions
 //*****************************************************************************
 
+struct rtap_frame;
+
 typedef uint32_t rtap_filter_id_t;
 
 typedef enum rtap_filter_type
@@ -58,6 +60,10 @@ typedef enum rtap_filter_type
     FILTER_TYPE_IP = 4,
     FILTER_TYPE_UDP = 5,
     FILTER_TYPE_TCP = 6,
+    FILTER_TYPE_BPF = 7,
+    FILTER_TYPE_MACSET = 8, // Address role subtypes as for FILTER_TYPE_80211
+    FILTER_TYPE_MACPREFIX = 9, // Same, against the prefixes of a MAC set
+    FILTER_TYPE_IE = 10, // Elements of beacon, probe and (re)assoc frames
     FILTER_TYPE_LAST
 } rtap_filter_type_t;
 
@@ -68,12 +74,31 @@ typedef enum rtap_filter_subtype
     FILTER_SUBTYPE_ALL_SIZE_EQ = 2,
     FILTER_SUBTYPE_ALL_SIZE_GE = 3,
     FILTER_SUBTYPE_ALL_SIZE_LE = 4,
-    FILTER_SUBTYPE_RTAP_DB = 1,
+    FILTER_SUBTYPE_RTAP_DB = 1, // Antenna signal dBm; ranges are "MIN [MAX]"
+    FILTER_SUBTYPE_RTAP_NOISE = 2, // Antenna noise dBm
+    FILTER_SUBTYPE_RTAP_FREQ = 3, // Channel MHz
+    FILTER_SUBTYPE_RTAP_CHANFLAGS = 4, // Hex channel flags, optionally "/mask"
+    FILTER_SUBTYPE_RTAP_RATE = 5, // Legacy rate in 500 kbps units
+    FILTER_SUBTYPE_RTAP_MCS = 6, // HT MCS index
+    FILTER_SUBTYPE_RTAP_NSS = 7, // VHT spatial streams
+    FILTER_SUBTYPE_RTAP_BADFCS = 8, // 1 matches frames failing FCS, 0 the rest
+    FILTER_SUBTYPE_RTAP_TSFT = 9, // Usecs
     FILTER_SUBTYPE_80211_SA = 1,
     FILTER_SUBTYPE_80211_DA = 2,
     FILTER_SUBTYPE_80211_TA = 3,
     FILTER_SUBTYPE_80211_RA = 4,
-    FILTER_SUBTYPE_80211_FCTL = 5,
+    FILTER_SUBTYPE_80211_FCTL = 5, // Hex value, optionally "/mask"; mask defaults to type/subtype
+    FILTER_SUBTYPE_80211_BSSID = 6,
+    FILTER_SUBTYPE_MACSET_SA = FILTER_SUBTYPE_80211_SA, // Argument names the set
+    FILTER_SUBTYPE_MACSET_DA = FILTER_SUBTYPE_80211_DA,
+    FILTER_SUBTYPE_MACSET_TA = FILTER_SUBTYPE_80211_TA,
+    FILTER_SUBTYPE_MACSET_RA = FILTER_SUBTYPE_80211_RA,
+    FILTER_SUBTYPE_MACSET_BSSID = FILTER_SUBTYPE_80211_BSSID,
+    FILTER_SUBTYPE_IE_SSID = 1, // "ssid,ssid,prefix*,..."
+    FILTER_SUBTYPE_IE_ID = 2, // "id,id,..."
+    FILTER_SUBTYPE_IE_VENDOR = 3, // "xx:xx:xx[:type],..."
+    FILTER_SUBTYPE_BPF_CLASSIC = 1, // Bytecode: "N,code jt jf k,code jt jf k,..."
+    FILTER_SUBTYPE_BPF_EBPF = 2, // File descriptor of a loaded socket filter
     FILTER_SUBTYPE_LAST
 } rtap_filter_subtype_t;
 
@@ -96,7 +121,10 @@ extern int rtap_filter_exit( void );
 extern int rtap_filter_register( rtap_filter_func func );
 extern int rtap_filter_unregister( rtap_filter_func func );
 
-extern int rtap_filter_recv( struct sk_buff *skb );
+extern int rtap_filter_recv( struct rtap_frame *frame );
+extern void rtap_filter_sync( void );
+
+extern bool rtap_filter_prematch( unsigned int len, const __le16 *fctl );
 
 #endif
 
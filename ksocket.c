@@ -119,6 +119,24 @@ ssize_t ksendto( ksocket_t socket, void *message, size_t length, int flags,
     return( len );
 }
 
+//*****************************************************************************
+ssize_t ksendmsg( ksocket_t socket, struct kvec *vec, size_t nvec, size_t length,
+                  int flags, const struct sockaddr *dest_addr, int dest_len )
+{
+    struct msghdr msg;
+
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_flags = flags;
+    if ( dest_addr )
+    {
+        msg.msg_name = (void *)dest_addr;
+        msg.msg_namelen = dest_len;
+    } // end if
+
+    // Gathers all vectors into a single datagram
+    return( kernel_sendmsg( (struct socket *)socket, &msg, vec, nvec, length ) );
+}
+
 //*****************************************************************************
 int inet_aton( const char *cp, struct in_addr *inp )
 {
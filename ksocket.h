@@ -30,6 +30,7 @@
 struct socket;
 struct sockaddr;
 struct in_addr;
+struct kvec;
 typedef int socklen_t;
 typedef struct socket *ksocket_t;
 
@@ -42,6 +43,9 @@ int kclose( ksocket_t socket );
 ssize_t ksendto( ksocket_t sock, void *msg, size_t msglen, int flags,
                    const struct sockaddr *dest_addr, socklen_t len );
 
+ssize_t ksendmsg( ksocket_t sock, struct kvec *vec, size_t nvec, size_t msglen,
+                  int flags, const struct sockaddr *dest_addr, socklen_t len );
+
 extern const char *inet_ntoa( struct in_addr in );
 extern int inet_aton( const char *cp, struct in_addr *inp );
 
@@ -28,6 +28,7 @@
 #include <linux/slab.h>
 #include <linux/gfp.h>
 #include <linux/list.h>
+#include <linux/kref.h>
 #include <linux/seq_file.h>
 #include <linux/if_ether.h>
 #include <linux/net.h>
@@ -36,12 +37,14 @@
 #include <linux/byteorder/generic.h>
 
 #include "ksocket.h"
+#include "device.h"
 #include "listener.h"
 
 struct rtap_listener
 {
   struct list_head list;
   spinlock_t lock;
+  struct kref ref; // List and each deferred send hold one
   rtap_listener_id_t lid;
   char *ipaddr;
   uint16_t port;
@@ -80,6 +83,15 @@ listener_destroy(struct rtap_listener* l)
   }
 }
 
+/******************************************************************************
+ *
+******************************************************************************/
+static void
+listener_release(struct kref* ref)
+{
+  listener_destroy(container_of(ref, struct rtap_listener, ref));
+}
+
 /******************************************************************************
  *
 ******************************************************************************/
@@ -96,6 +108,7 @@ listener_create(void)
     return (NULL);
   } // end if
   memset((void *) l, 0, sizeof(struct rtap_listener));
+  kref_init(&l->ref);
 
   // Allocate buffer for IP address
   l->ipaddr = kmalloc(32, GFP_KERNEL);
@@ -115,6 +128,8 @@ listener_create(void)
     listener_destroy(l);
     return (NULL);
   } // end if
+  // Inline capture sends from softirq context and must never sleep
+  l->sockfd->sk->sk_allocation = GFP_ATOMIC;
   l->in_addr.sin_family = AF_INET;
 
   return (l);
@@ -130,7 +145,8 @@ listener_remove(struct rtap_listener* l)
   {
     printk( KERN_INFO "RTAP: Removing listener: %s:%hu\n", l->ipaddr, l->port);
     list_del(&l->list);
-    listener_destroy(l);
+    // Sends still queued to a device worker keep it until they complete
+    listener_put(l);
   }
   return (0);
 }
@@ -182,6 +198,31 @@ listener_clear(void)
 // Global Functions
 //*****************************************************************************
 
+/******************************************************************************
+ * Safe from any context; used to hold a listener across a deferred send.
+******************************************************************************/
+struct rtap_listener*
+listener_get(struct rtap_listener* l)
+{
+  if (l)
+  {
+    kref_get(&l->ref);
+  }
+  return (l);
+}
+
+/******************************************************************************
+ *
+******************************************************************************/
+void
+listener_put(struct rtap_listener* l)
+{
+  if (l)
+  {
+    kref_put(&l->ref, listener_release);
+  }
+}
+
 /******************************************************************************
  *
 ******************************************************************************/
@@ -321,6 +362,30 @@ listener_findbyid(rtap_listener_id_t lid)
 
 }
 
+/******************************************************************************
+ * Like listener_findbyid(), but the reference is taken under the list lock
+ * so the listener cannot be removed between lookup and use.
+******************************************************************************/
+struct rtap_listener*
+listener_getbyid(rtap_listener_id_t lid)
+{
+  struct rtap_listener *listener = NULL;
+  struct rtap_listener *l = NULL;
+
+  spin_lock(&rtap_listeners.lock);
+  list_for_each_entry(l, &rtap_listeners.list, list)
+  {
+    if (l->lid == lid)
+    {
+      listener = listener_get(l);
+      break;
+    } // end if
+  } // end loop
+  spin_unlock(&rtap_listeners.lock);
+
+  return (listener);
+}
+
 /******************************************************************************
  *
 ******************************************************************************/
@@ -352,18 +417,93 @@ listener_findbyipandport(const char* addr, uint16_t port)
 
 }
 
+/******************************************************************************
+ * Describes the frame data as one vector per linear area and page fragment;
+ * returns the vector count or -1 if the frame has no stable kernel mapping.
+******************************************************************************/
+static int
+listener_skb_vec(const struct sk_buff* skb, struct kvec* vec)
+{
+  int n = 0;
+  int i;
+
+  // Frame lists and highmem pages have to go through a private copy
+  if (skb_has_frag_list(skb))
+  {
+    return (-1);
+  }
+
+  if (skb_headlen(skb))
+  {
+    vec[n].iov_base = skb->data;
+    vec[n].iov_len = skb_headlen(skb);
+    n++;
+  }
+  for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
+  {
+    const skb_frag_t* frag = &skb_shinfo(skb)->frags[i];
+    if (PageHighMem(skb_frag_page(frag)))
+    {
+      return (-1);
+    }
+    vec[n].iov_base = skb_frag_address(frag);
+    vec[n].iov_len = skb_frag_size(frag);
+    n++;
+  } // end loop
+
+  return (n);
+}
+
 /******************************************************************************
  *
 ******************************************************************************/
 int
-listener_send(struct rtap_listener* l, struct sk_buff* skb)
+listener_send(struct rtap_listener* l, struct rtap_frame* frame)
 {
   int ret = 0;
-  if (l && skb)
+  if (l && frame)
   {
+    const struct rtap_device_skbmeta* meta = rtap_device_get_skbmeta(frame);
+    struct sk_buff* skb = frame->skb;
+    struct sk_buff* lskb = NULL;
+    struct kvec vec[2 + MAX_SKB_FRAGS];
+    int nvec = 0;
+
+    // Metadata header and every fragment of the frame are gathered into one
+    // datagram; only frames without a stable mapping are copied
+    vec[0].iov_base = (void *) meta;
+    vec[0].iov_len = sizeof(struct rtap_device_skbmeta);
+    nvec = listener_skb_vec(skb, &vec[1]);
+    if (nvec < 0)
+    {
+      lskb = skb_copy(skb, GFP_ATOMIC);
+      if (!lskb)
+      {
+        return (-ENOMEM);
+      }
+      skb = lskb;
+      vec[1].iov_base = skb->data;
+      vec[1].iov_len = skb->len;
+      nvec = 1;
+    }
+
 //    printk( KERN_INFO "RTAP: Sending to listener: %s:%hu\n", l->ipaddr, l->port);
-    ret = ksendto(l->sockfd, skb->data, skb->len, 0,
+    ret = ksendmsg(l->sockfd, vec, 1 + nvec, vec[0].iov_len + skb->len, frame->sendflags,
         (const struct sockaddr *) &l->in_addr, sizeof(l->in_addr));
+    if ((ret == -EAGAIN) && (frame->sendflags & MSG_DONTWAIT))
+    {
+      // Would block in softirq; let the device worker finish this send
+      ret = rtap_device_defer(frame, l);
+    }
+    else if (ret >= 0)
+    {
+      rtap_device_sent(frame);
+    }
+
+    if (lskb)
+    {
+      kfree_skb(lskb);
+    }
   }
   return (ret);
 }
@@ -41,6 +41,7 @@
 typedef uint32_t rtap_listener_id_t;
 
 struct rtap_listener;
+struct rtap_frame;
 
 //*****************************************************************************
 // Global variables
@@ -67,13 +68,22 @@ listener_get_ipaddr( struct rtap_listener* l );
 extern uint16_t
 listener_get_port( struct rtap_listener* l );
 
+extern struct rtap_listener*
+listener_get( struct rtap_listener* l );
+
+extern void
+listener_put( struct rtap_listener* l );
+
 extern struct rtap_listener*
 listener_findbyid(rtap_listener_id_t lid);
 
+extern struct rtap_listener*
+listener_getbyid(rtap_listener_id_t lid);
+
 extern struct rtap_listener*
 listener_findbyipandport(const char* addr, uint16_t port);
 
 extern int
-listener_send( struct rtap_listener* l, struct sk_buff *skb );
+listener_send( struct rtap_listener* l, struct rtap_frame *frame );
 
 #endif
@@ -0,0 +1,932 @@
+//*****************************************************************************
+//    Copyright (C) 2014 ZenoTec LLC (http://www.zenotec.net)
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License along
+//    with this program; if not, write to the Free Software Foundation, Inc.,
+//    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+//    File: macset.c
+//    Description: Named sets of MAC addresses matched by filters with a
+//                 single hash lookup, and of MAC prefixes matched through a
+//                 compiled multibit trie. Sets are updated in place, so large
+//                 watchlists never require rebuilding a filter chain.
+//
+//*****************************************************************************
+
+//*****************************************************************************
+// Includes
+//*****************************************************************************
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/rhashtable.h>
+#include <linux/rbtree.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/etherdevice.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <asm/unaligned.h>
+
+#include "macset.h"
+
+//*****************************************************************************
+// Type definitions
+//*****************************************************************************
+
+#define RTAP_MACSET_NAME_MAX    32
+#define RTAP_MACSET_CMD_MAX     PAGE_SIZE
+#define RTAP_MACSET_BITS        (ETH_ALEN * 8)
+#define RTAP_MACSET_STRIDE      4 // Bits per trie level
+#define RTAP_MACSET_LEVELS      (RTAP_MACSET_BITS / RTAP_MACSET_STRIDE)
+#define RTAP_MACSET_NIBBLE(v, d) \
+  ((u32) ((v) >> (RTAP_MACSET_BITS - RTAP_MACSET_STRIDE * ((d) + 1))) & 0xf)
+
+struct rtap_macset_entry
+{
+  struct rhash_head node;
+  u8 addr[ETH_ALEN];
+  struct rcu_head rcu;
+};
+
+// Prefix as configured; address in the low 48 bits, host order
+struct rtap_macset_prefix
+{
+  struct rb_node node;
+  u64 val;
+  u8 len;
+};
+
+// One level of the compiled trie consumes one nibble of the address. Each
+// node is a bitmap of nibbles that complete a prefix and a bitmap of nibbles
+// with a deeper node; the children of a node are stored contiguously from
+// 'base' in nibble order. Prefixes that do not end on a nibble boundary are
+// expanded, so a lookup is at most one 8 byte node per nibble.
+struct rtap_macset_node
+{
+  u16 child;
+  u16 match;
+  u32 base;
+};
+
+struct rtap_macset_trie
+{
+  struct rcu_head rcu;
+  u32 nnodes;
+  struct rtap_macset_node nodes[];
+};
+
+// One reference is held by the set list, one by every filter using the set
+struct rtap_macset
+{
+  struct list_head list;
+  struct kref ref;
+  struct rhashtable table;
+  struct rb_root prefixes; // Sorted by value then length
+  u32 nprefixes;
+  struct rtap_macset_trie __rcu* trie; // Compiled from 'prefixes'
+  struct work_struct free_work;
+  char name[RTAP_MACSET_NAME_MAX];
+};
+
+//*****************************************************************************
+// Global variables
+//*****************************************************************************
+
+/* Global */
+
+/* Local */
+
+static const struct rhashtable_params rtap_macset_params =
+{
+    .head_offset = offsetof(struct rtap_macset_entry, node),
+    .key_offset = offsetof(struct rtap_macset_entry, addr),
+    .key_len = ETH_ALEN,
+    .automatic_shrinking = true,
+};
+
+static LIST_HEAD(rtap_macsets);
+static DEFINE_MUTEX(rtap_macsets_mutex); // Set list and all set updates
+static atomic_t rtap_macsets_live = ATOMIC_INIT(0); // Sets not yet freed
+
+//*****************************************************************************
+// Local Functions
+//*****************************************************************************
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_macset_free_entry(void* ptr, void* arg)
+{
+  kfree(ptr);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_macset_free_trie(struct rcu_head* rcu)
+{
+  vfree(container_of(rcu, struct rtap_macset_trie, rcu));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_macset_free_work(struct work_struct* work)
+{
+  struct rtap_macset* s = container_of(work, struct rtap_macset, free_work);
+  struct rtap_macset_prefix* p = NULL;
+  struct rtap_macset_prefix* tmp = NULL;
+
+  rhashtable_free_and_destroy(&s->table, rtap_macset_free_entry, NULL);
+  rbtree_postorder_for_each_entry_safe(p, tmp, &s->prefixes, node)
+  {
+    kfree(p);
+  } // end loop
+  vfree(rcu_dereference_protected(s->trie, 1));
+  kfree(s);
+  atomic_dec(&rtap_macsets_live);
+}
+
+/******************************************************************************
+ * The last reference may go from wherever a filter is destroyed; tearing
+ * down the table can sleep, so it is left to a work item.
+ ******************************************************************************/
+static void
+rtap_macset_release(struct kref* ref)
+{
+  struct rtap_macset* s = container_of(ref, struct rtap_macset, ref);
+  schedule_work(&s->free_work);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct rtap_macset*
+rtap_macset_find(const char* name)
+{
+  struct rtap_macset* s = NULL;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+  list_for_each_entry(s, &rtap_macsets, list)
+  {
+    if (!strcmp(s->name, name))
+    {
+      return (s);
+    }
+  } // end loop
+
+  return (NULL);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct rtap_macset*
+rtap_macset_create(const char* name)
+{
+  struct rtap_macset* s = NULL;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  s = kzalloc(sizeof(struct rtap_macset), GFP_KERNEL);
+  if (!s)
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate memory\n");
+    return (NULL);
+  } // end if
+  if (rhashtable_init(&s->table, &rtap_macset_params))
+  {
+    printk( KERN_CRIT "RTAP: Cannot allocate MAC set table\n");
+    kfree(s);
+    return (NULL);
+  } // end if
+  strlcpy(s->name, name, sizeof(s->name));
+  kref_init(&s->ref);
+  INIT_WORK(&s->free_work, rtap_macset_free_work);
+  atomic_inc(&rtap_macsets_live);
+
+  printk( KERN_INFO "RTAP: Adding MAC set: %s\n", s->name);
+  list_add_tail(&s->list, &rtap_macsets);
+
+  return (s);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void
+rtap_macset_remove(struct rtap_macset* s)
+{
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  // Filters still using the set keep it until they are removed themselves
+  printk( KERN_INFO "RTAP: Removing MAC set: %s\n", s->name);
+  list_del(&s->list);
+  rtap_macset_put(s);
+}
+
+/******************************************************************************
+ * A set is busy while a filter holds it beyond the list's own reference;
+ * unlinking it then would leave the filter matching an orphan nobody can
+ * update, while a set recreated by name goes unused.
+ ******************************************************************************/
+static bool
+rtap_macset_busy(struct rtap_macset* s)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+  return (atomic_read(&s->ref.refcount) > 1);
+#else
+  return (kref_read(&s->ref) > 1);
+#endif
+}
+
+/******************************************************************************
+ * Busy sets are kept unless 'force' is set, as on module exit once every
+ * filter is gone.
+ ******************************************************************************/
+static int
+rtap_macset_clear(bool force)
+{
+  struct rtap_macset* s = NULL;
+  struct rtap_macset* tmp = NULL;
+  int ret = 0;
+
+  mutex_lock(&rtap_macsets_mutex);
+  list_for_each_entry_safe(s, tmp, &rtap_macsets, list)
+  {
+    if (!force && rtap_macset_busy(s))
+    {
+      printk( KERN_ERR "RTAP: MAC set in use by filters: %s\n", s->name);
+      ret = -EBUSY;
+      continue;
+    }
+    rtap_macset_remove(s);
+  } // end loop
+  mutex_unlock(&rtap_macsets_mutex);
+
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_macset_add_addr(struct rtap_macset* s, const u8* addr)
+{
+  struct rtap_macset_entry* e = NULL;
+  int ret = 0;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  e = kmalloc(sizeof(struct rtap_macset_entry), GFP_KERNEL);
+  if (!e)
+  {
+    return (-ENOMEM);
+  } // end if
+  ether_addr_copy(e->addr, addr);
+
+  // Readers see either the old or the new table contents, never a partial one
+  ret = rhashtable_lookup_insert_fast(&s->table, &e->node, rtap_macset_params);
+  if (ret)
+  {
+    kfree(e);
+  }
+  return ((ret == -EEXIST) ? 0 : ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+rtap_macset_del_addr(struct rtap_macset* s, const u8* addr)
+{
+  struct rtap_macset_entry* e = NULL;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  e = rhashtable_lookup_fast(&s->table, addr, rtap_macset_params);
+  if (e && !rhashtable_remove_fast(&s->table, &e->node, rtap_macset_params))
+  {
+    kfree_rcu(e, rcu);
+  }
+  return (0);
+}
+
+/******************************************************************************
+ * Adds a prefix to the configured set; returns 1 if the set changed.
+ ******************************************************************************/
+static int
+rtap_macset_add_prefix(struct rtap_macset* s, u64 val, u8 len)
+{
+  struct rb_node** link = &s->prefixes.rb_node;
+  struct rb_node* parent = NULL;
+  struct rtap_macset_prefix* p = NULL;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  while (*link)
+  {
+    parent = *link;
+    p = rb_entry(parent, struct rtap_macset_prefix, node);
+    if ((val < p->val) || ((val == p->val) && (len < p->len)))
+    {
+      link = &parent->rb_left;
+    }
+    else if ((val > p->val) || (len > p->len))
+    {
+      link = &parent->rb_right;
+    }
+    else
+    {
+      return (0);
+    }
+  } // end loop
+
+  p = kmalloc(sizeof(struct rtap_macset_prefix), GFP_KERNEL);
+  if (!p)
+  {
+    return (-ENOMEM);
+  } // end if
+  p->val = val;
+  p->len = len;
+  rb_link_node(&p->node, parent, link);
+  rb_insert_color(&p->node, &s->prefixes);
+  s->nprefixes++;
+
+  return (1);
+}
+
+/******************************************************************************
+ * Deletes a prefix from the configured set; returns 1 if the set changed.
+ ******************************************************************************/
+static int
+rtap_macset_del_prefix(struct rtap_macset* s, u64 val, u8 len)
+{
+  struct rb_node* n = s->prefixes.rb_node;
+  struct rtap_macset_prefix* p = NULL;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  while (n)
+  {
+    p = rb_entry(n, struct rtap_macset_prefix, node);
+    if ((val < p->val) || ((val == p->val) && (len < p->len)))
+    {
+      n = n->rb_left;
+    }
+    else if ((val > p->val) || (len > p->len))
+    {
+      n = n->rb_right;
+    }
+    else
+    {
+      rb_erase(&p->node, &s->prefixes);
+      kfree(p);
+      s->nprefixes--;
+      return (1);
+    }
+  } // end loop
+
+  return (0);
+}
+
+/******************************************************************************
+ * Lays out the node for prefixes [lo, hi), which share their first 'depth'
+ * nibbles, at 'idx' and recurses into its children. Without 'nodes' it only
+ * counts the nodes needed.
+ ******************************************************************************/
+static void
+rtap_macset_build(struct rtap_macset_prefix* const* p, u32 lo, u32 hi, u32 depth,
+    struct rtap_macset_node* nodes, u32 idx, u32* next)
+{
+  u32 start[16] = { 0 };
+  u32 end[16] = { 0 };
+  u16 match = 0;
+  u16 child = 0;
+  u32 base = 0;
+  u32 level = 0;
+  u32 i = 0;
+  u32 v = 0;
+
+  for (i = lo; i < hi; i++)
+  {
+    v = RTAP_MACSET_NIBBLE(p[i]->val, depth);
+    level = (p[i]->len ? ((p[i]->len - 1) / RTAP_MACSET_STRIDE) : 0);
+    if (level == depth)
+    {
+      // Expand the remaining bits of the nibble; values are pre-masked
+      u32 span = 1U << (RTAP_MACSET_STRIDE * (depth + 1) - p[i]->len);
+      match |= ((1U << span) - 1) << v;
+    }
+    else if (level > depth)
+    {
+      if (!end[v])
+      {
+        start[v] = i;
+      }
+      end[v] = i + 1;
+    }
+  } // end loop
+
+  // A nibble already matched needs nothing deeper
+  for (v = 0; v < 16; v++)
+  {
+    if (end[v] && !(match & BIT(v)))
+    {
+      child |= BIT(v);
+    }
+  } // end loop
+
+  base = *next;
+  *next += hweight16(child);
+  if (nodes)
+  {
+    nodes[idx].child = child;
+    nodes[idx].match = match;
+    nodes[idx].base = base;
+  }
+
+  for (v = 0; v < 16; v++)
+  {
+    if (child & BIT(v))
+    {
+      rtap_macset_build(p, start[v], end[v], depth + 1, nodes, base++, next);
+    }
+  } // end loop
+}
+
+/******************************************************************************
+ * Compiles the configured prefixes into a new trie and publishes it; the old
+ * one stays in use until readers are done with it.
+ ******************************************************************************/
+static int
+rtap_macset_compile(struct rtap_macset* s)
+{
+  struct rtap_macset_prefix** p = NULL;
+  struct rtap_macset_trie* t = NULL;
+  struct rtap_macset_trie* old = NULL;
+  struct rb_node* n = NULL;
+  u32 nnodes = 1;
+  u32 i = 0;
+
+  lockdep_assert_held(&rtap_macsets_mutex);
+
+  if (s->nprefixes)
+  {
+    p = vmalloc(s->nprefixes * sizeof(*p));
+    if (!p)
+    {
+      return (-ENOMEM);
+    } // end if
+    for (n = rb_first(&s->prefixes); n; n = rb_next(n))
+    {
+      p[i++] = rb_entry(n, struct rtap_macset_prefix, node);
+    } // end loop
+
+    rtap_macset_build(p, 0, s->nprefixes, 0, NULL, 0, &nnodes);
+    t = vzalloc(sizeof(struct rtap_macset_trie) + nnodes * sizeof(struct rtap_macset_node));
+    if (!t)
+    {
+      vfree(p);
+      return (-ENOMEM);
+    } // end if
+    t->nnodes = nnodes;
+    nnodes = 1;
+    rtap_macset_build(p, 0, s->nprefixes, 0, t->nodes, 0, &nnodes);
+    vfree(p);
+  }
+
+  old = rcu_dereference_protected(s->trie, lockdep_is_held(&rtap_macsets_mutex));
+  rcu_assign_pointer(s->trie, t);
+  if (old)
+  {
+    call_rcu(&old->rcu, rtap_macset_free_trie);
+  }
+
+  return (0);
+}
+
+/******************************************************************************
+ * Parses "xx:xx:xx/len"; unspecified trailing octets are zero.
+ ******************************************************************************/
+static int
+rtap_macset_parse_prefix(char* str, u64* val, u8* len)
+{
+  char* slash = strchr(str, '/');
+  char* tok = NULL;
+  unsigned int bits = 0;
+  int n = 0;
+  u8 b = 0;
+
+  if (!slash || kstrtouint(slash + 1, 10, &bits) || (bits > RTAP_MACSET_BITS))
+  {
+    return (-EINVAL);
+  }
+  *slash = 0;
+
+  *val = 0;
+  while ((n < ETH_ALEN) && (tok = strsep(&str, ":")))
+  {
+    if (kstrtou8(tok, 16, &b))
+    {
+      return (-EINVAL);
+    }
+    *val |= (u64) b << (RTAP_MACSET_BITS - 8 * (n + 1));
+    n++;
+  } // end loop
+  if (str || (bits > (n * 8)))
+  {
+    return (-EINVAL);
+  }
+
+  // Bits past the prefix length are ignored
+  *val &= (bits ? (~0ULL << (RTAP_MACSET_BITS - bits)) : 0) & ((1ULL << RTAP_MACSET_BITS) - 1);
+  *len = bits;
+  return (0);
+}
+
+//*****************************************************************************
+// Global Functions
+//*****************************************************************************
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int
+rtap_macset_init(void)
+{
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int
+rtap_macset_exit(void)
+{
+  rtap_macset_clear(true);
+
+  // Sets freed above are torn down from the shared workqueue
+  flush_scheduled_work();
+  rcu_barrier();
+
+  // Filters are destroyed first, so any set left here lost a put
+  if (atomic_read(&rtap_macsets_live))
+  {
+    printk( KERN_WARNING "RTAP: %d MAC sets still referenced at exit\n",
+        atomic_read(&rtap_macsets_live));
+  } // end if
+  return (0);
+}
+
+/******************************************************************************
+ * Finds the named set, creating it empty if need be, and takes a reference
+ * for the caller. Filters may therefore be added before their addresses.
+ ******************************************************************************/
+struct rtap_macset*
+rtap_macset_get(const char* name)
+{
+  struct rtap_macset* s = NULL;
+
+  if (!name || !*name || (strlen(name) >= RTAP_MACSET_NAME_MAX))
+  {
+    return (NULL);
+  }
+
+  mutex_lock(&rtap_macsets_mutex);
+  s = rtap_macset_find(name);
+  if (!s)
+  {
+    s = rtap_macset_create(name);
+  }
+  if (s)
+  {
+    kref_get(&s->ref);
+  }
+  mutex_unlock(&rtap_macsets_mutex);
+
+  return (s);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void
+rtap_macset_put(struct rtap_macset* s)
+{
+  if (s)
+  {
+    kref_put(&s->ref, rtap_macset_release);
+  }
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+const char*
+rtap_macset_get_name(struct rtap_macset* s)
+{
+  const char* name = NULL;
+  if (s)
+  {
+    name = s->name;
+  }
+  return (name);
+}
+
+/******************************************************************************
+ * Safe from any context; the lookup runs under RCU.
+ ******************************************************************************/
+bool
+rtap_macset_contains(struct rtap_macset* s, const u8* addr)
+{
+  return (rhashtable_lookup_fast(&s->table, addr, rtap_macset_params) != NULL);
+}
+
+/******************************************************************************
+ * Safe from any context; walks at most one trie node per address nibble.
+ ******************************************************************************/
+bool
+rtap_macset_contains_prefix(struct rtap_macset* s, const u8* addr)
+{
+  const struct rtap_macset_trie* t = NULL;
+  const struct rtap_macset_node* n = NULL;
+  u64 val = ((u64) get_unaligned_be16(addr) << 32) | get_unaligned_be32(addr + 2);
+  bool ret = false;
+  u32 idx = 0;
+  u32 d = 0;
+  u32 v = 0;
+
+  rcu_read_lock();
+  t = rcu_dereference(s->trie);
+  for (d = 0; t && (d < RTAP_MACSET_LEVELS); d++)
+  {
+    n = &t->nodes[idx];
+    v = RTAP_MACSET_NIBBLE(val, d);
+    if (n->match & BIT(v))
+    {
+      ret = true;
+      break;
+    }
+    if (!(n->child & BIT(v)))
+    {
+      break;
+    }
+    idx = n->base + hweight16(n->child & (BIT(v) - 1));
+  } // end loop
+  rcu_read_unlock();
+
+  return (ret);
+}
+
+//*****************************************************************************
+// Proc Filesystem Functions
+//*****************************************************************************
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+proc_show(struct seq_file *file, void *arg)
+{
+  struct rtap_macset* s = NULL;
+
+  mutex_lock(&rtap_macsets_mutex);
+  list_for_each_entry(s, &rtap_macsets, list)
+  {
+    const struct rtap_macset_trie* t = rcu_dereference_protected(s->trie,
+        lockdep_is_held(&rtap_macsets_mutex));
+    seq_printf( file, "%s\taddrs[%u]\tprefixes[%u]\tnodes[%u]\n", s->name,
+        atomic_read(&s->table.nelems), s->nprefixes, (t ? t->nnodes : 0) );
+  } // end loop
+  mutex_unlock(&rtap_macsets_mutex);
+
+  return (0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+proc_open(struct inode *inode, struct file *file)
+{
+  return (single_open(file, proc_show, NULL));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int
+proc_close(struct inode *inode, struct file *file)
+{
+  return (single_release(inode, file));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static ssize_t
+proc_read(struct file *file, char __user *buf, size_t cnt, loff_t *off)
+{
+  return (seq_read(file, buf, cnt, off));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static loff_t
+proc_lseek(struct file *file, loff_t off, int cnt)
+{
+  return (seq_lseek(file, off, cnt));
+}
+
+/******************************************************************************
+ * "-" removes all sets, "-<name>" one set; "<name> + <mac> ..." adds and
+ * "<name> - <mac> ..." deletes addresses, creating the set if need be. An
+ * address written as "<mac>/<bits>" is a prefix.
+ ******************************************************************************/
+static int
+rtap_macset_cmd(char* cmdstr)
+{
+  struct rtap_macset* s = NULL;
+  char* str = strim(cmdstr);
+  char* name = NULL;
+  char* op = NULL;
+  char* tok = NULL;
+  u8 addr[ETH_ALEN];
+  bool recompile = false;
+  u64 val = 0;
+  u8 len = 0;
+  int ret = 0;
+
+  if (!strcmp(str, "-"))
+  {
+    return (rtap_macset_clear(false));
+  }
+
+  mutex_lock(&rtap_macsets_mutex);
+  if (str[0] == '-')
+  {
+    s = rtap_macset_find(&str[1]);
+    if (!s)
+    {
+      ret = -ENOENT;
+    }
+    else if (rtap_macset_busy(s))
+    {
+      // Empty it with "<name> - ..." or remove its filters first
+      printk( KERN_ERR "RTAP: MAC set in use by filters: %s\n", s->name);
+      ret = -EBUSY;
+    }
+    else
+    {
+      rtap_macset_remove(s);
+    }
+    mutex_unlock(&rtap_macsets_mutex);
+    return (ret);
+  }
+
+  name = strsep(&str, " \t");
+  if (str)
+  {
+    str = skip_spaces(str);
+    op = strsep(&str, " \t");
+  }
+  // A blank write strims to nothing; never create a set without a name
+  if (!*name || (strlen(name) >= RTAP_MACSET_NAME_MAX))
+  {
+    mutex_unlock(&rtap_macsets_mutex);
+    return (-EINVAL);
+  }
+  s = rtap_macset_find(name);
+  if (!s && !(s = rtap_macset_create(name)))
+  {
+    mutex_unlock(&rtap_macsets_mutex);
+    return (-ENOMEM);
+  }
+
+  // Addresses apply one at a time; frames may match any prefix of the update
+  while (op && !ret && (tok = strsep(&str, " \t\n")))
+  {
+    if (!*tok)
+    {
+      continue;
+    }
+    if (strchr(tok, '/'))
+    {
+      if (rtap_macset_parse_prefix(tok, &val, &len))
+      {
+        printk( KERN_ERR "RTAP: Invalid MAC prefix: %s\n", tok);
+        ret = -EINVAL;
+      }
+      else if (!strcmp(op, "+") || !strcmp(op, "-"))
+      {
+        ret = ((op[0] == '+') ? rtap_macset_add_prefix(s, val, len) :
+            rtap_macset_del_prefix(s, val, len));
+        recompile |= (ret > 0);
+        ret = min(ret, 0);
+      }
+      else
+      {
+        ret = -EINVAL;
+      }
+    }
+    else if (!mac_pton(tok, addr))
+    {
+      printk( KERN_ERR "RTAP: Invalid MAC address: %s\n", tok);
+      ret = -EINVAL;
+    }
+    else if (!strcmp(op, "+"))
+    {
+      ret = rtap_macset_add_addr(s, addr);
+    }
+    else if (!strcmp(op, "-"))
+    {
+      ret = rtap_macset_del_addr(s, addr);
+    }
+    else
+    {
+      printk( KERN_ERR "RTAP: Failed parsing MAC set string: %s\n", op);
+      ret = -EINVAL;
+    }
+  } // end loop
+
+  // Prefixes applied so far take effect even if a later one was rejected
+  if (recompile && rtap_macset_compile(s) && !ret)
+  {
+    ret = -ENOMEM;
+  }
+  mutex_unlock(&rtap_macsets_mutex);
+
+  return (ret);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static ssize_t
+proc_write(struct file *file, const char __user *buf, size_t cnt, loff_t *off)
+{
+  char* cmdstr = NULL;
+  ssize_t ret = 0;
+
+  if (!cnt)
+  {
+    return (cnt);
+  } // end if
+
+  // Room for a few hundred addresses per write
+  cnt = (cnt >= RTAP_MACSET_CMD_MAX) ? (RTAP_MACSET_CMD_MAX - 1) : cnt;
+  cmdstr = kzalloc(RTAP_MACSET_CMD_MAX, GFP_KERNEL);
+  if (!cmdstr)
+  {
+    return (-ENOMEM);
+  } // end if
+  if (copy_from_user(cmdstr, buf, cnt))
+  {
+    kfree(cmdstr);
+    return (-EFAULT);
+  } // end if
+
+  ret = rtap_macset_cmd(cmdstr);
+  kfree(cmdstr);
+  if (ret)
+  {
+    return (ret);
+  } // end if
+
+  // Return number of bytes written
+  return (cnt);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+const struct file_operations rtap_macset_fops =
+{
+    .owner      = THIS_MODULE,
+    .open       = proc_open,
+    .release    = proc_close,
+    .read       = proc_read,
+    .llseek     = proc_lseek,
+    .write      = proc_write,
+};
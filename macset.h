@@ -0,0 +1,70 @@
+//*****************************************************************************
+//    Copyright (C) 2014 ZenoTec LLC (http://www.zenotec.net)
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License along
+//    with this program; if not, write to the Free Software Foundation, Inc.,
+//    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+//    File: macset.h
+//    Description: Named sets of MAC addresses and MAC prefixes matched by
+//                 filters.
+//
+//*****************************************************************************
+
+#ifndef __MACSET_H__
+#define __MACSET_H__
+
+//*****************************************************************************
+// Includes
+//*****************************************************************************
+
+#include <linux/types.h>
+
+//*****************************************************************************
+// Type definitions
+//*****************************************************************************
+
+struct rtap_macset;
+
+//*****************************************************************************
+// Global variables
+//*****************************************************************************
+
+extern const struct file_operations rtap_macset_fops;
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+extern int
+rtap_macset_init( void );
+
+extern int
+rtap_macset_exit( void );
+
+extern struct rtap_macset*
+rtap_macset_get( const char* name );
+
+extern void
+rtap_macset_put( struct rtap_macset* s );
+
+extern const char*
+rtap_macset_get_name( struct rtap_macset* s );
+
+extern bool
+rtap_macset_contains( struct rtap_macset* s, const u8* addr );
+
+extern bool
+rtap_macset_contains_prefix( struct rtap_macset* s, const u8* addr );
+
+#endif
@@ -32,6 +32,7 @@
 #include "rule.h"
 #include "filter.h"
 #include "stats.h"
+#include "macset.h"
 
 //*****************************************************************************
 // Variables
@@ -56,6 +57,7 @@ rtap_proc_init( void )
     proc_create( "rules", 0666, rtap_proc_dir, &rtap_rule_fops );
     proc_create( "listeners", 0666, rtap_proc_dir, &listener_fops );
     proc_create( "filters", 0666, rtap_proc_dir, &rtap_filter_fops );
+    proc_create( "macsets", 0666, rtap_proc_dir, &rtap_macset_fops );
     proc_create( "stats", 0666, rtap_proc_dir, &stats_fops );
     return( 0 );
 }
@@ -68,6 +70,7 @@ rtap_proc_exit( void )
     remove_proc_entry( "rules", rtap_proc_dir );
     remove_proc_entry( "listeners", rtap_proc_dir );
     remove_proc_entry( "filters", rtap_proc_dir );
+    remove_proc_entry( "macsets", rtap_proc_dir );
     remove_proc_entry( "stats", rtap_proc_dir );
     remove_proc_entry( "rtap", NULL );
     return( 0 );
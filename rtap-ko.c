@@ -32,6 +32,7 @@
 #include "rtap-ko.h"
 #include "rule.h"
 #include "filter.h"
+#include "macset.h"
 #include "stats.h"
 #include "device.h"
 #include "listener.h"
@@ -46,10 +47,14 @@ static int __init
 rtap_init( void )
 {
 
-    rtap_device_init();
+    if( rtap_device_init() )
+    {
+        return( -ENOMEM );
+    } // end if
     listener_init();
     stats_init();
     rtap_rule_init();
+    rtap_macset_init();
     rtap_filter_init();
     rtap_proc_init();
 
@@ -70,6 +75,7 @@ rtap_exit( void )
     stats_exit();
     rtap_rule_exit();
     rtap_filter_exit();
+    rtap_macset_exit();
     rtap_proc_exit();
 
     printk( KERN_INFO "RTAP: ...done.\n" );
@@ -32,8 +32,10 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 
+#include "device.h"
 #include "listener.h"
 #include "stats.h"
+#include "filter.h"
 #include "rule.h"
 
 //*****************************************************************************
@@ -41,7 +43,7 @@
 //*****************************************************************************
 
 typedef int
-(*rtap_rule_action_func)(struct rtap_rule* r, struct sk_buff *skb);
+(*rtap_rule_action_func)(struct rtap_rule* r, struct rtap_frame *frame);
 
 typedef struct rtap_rule
 {
@@ -79,6 +81,10 @@ rtap_rule_destroy(struct rtap_rule* r)
 {
   if (r)
   {
+    if ((r->aid == ACTION_FWRD) && r->arg.l)
+    {
+      listener_put(r->arg.l);
+    }
     kfree(r);
   }
 }
@@ -114,7 +120,11 @@ rtap_rule_remove(rtap_rule_t* r)
   if (r)
   {
     printk( KERN_INFO "RTAP: Removing rule: %u\n", r->rid);
+    spin_lock(&rtap_rules.lock);
     list_del(&r->list);
+    spin_unlock(&rtap_rules.lock);
+    // Frames already in the filters may still be forwarding through it
+    rtap_filter_sync();
     rtap_rule_destroy(r);
   }
   // Return NULL on success; negative on error
@@ -153,14 +163,20 @@ rtap_rule_clear(void)
 
   rtap_rule_t *r = NULL;
   rtap_rule_t *tmp = NULL;
+  LIST_HEAD(dead);
 
-  // Remove all rules from list
+  // Remove all rules from list; destroy once no frame can still use them
   spin_lock(&rtap_rules.lock);
-  list_for_each_entry_safe(r, tmp, &rtap_rules.list, list)
+  list_splice_init(&rtap_rules.list, &dead);
+  spin_unlock(&rtap_rules.lock);
+  rtap_filter_sync();
+
+  list_for_each_entry_safe(r, tmp, &dead, list)
   {
-    rtap_rule_remove(r);
+    printk( KERN_INFO "RTAP: Removing rule: %u\n", r->rid);
+    list_del(&r->list);
+    rtap_rule_destroy(r);
   } // end loop
-  spin_unlock(&rtap_rules.lock);
 
   // Return NULL on success; negative on error
   return (0);
@@ -169,7 +185,7 @@ rtap_rule_clear(void)
 //*****************************************************************************
 
 static int
-rtap_rule_action_none(struct rtap_rule* r, struct sk_buff *skb)
+rtap_rule_action_none(struct rtap_rule* r, struct rtap_frame *frame)
 {
   if (!r || r->aid != ACTION_NONE)
   {
@@ -182,7 +198,7 @@ rtap_rule_action_none(struct rtap_rule* r, struct sk_buff *skb)
 //*****************************************************************************
 
 static int
-rtap_rule_action_drop(struct rtap_rule* r, struct sk_buff *skb)
+rtap_rule_action_drop(struct rtap_rule* r, struct rtap_frame *frame)
 {
   if (!r || r->aid != ACTION_DROP)
   {
@@ -195,7 +211,7 @@ rtap_rule_action_drop(struct rtap_rule* r, struct sk_buff *skb)
 //*****************************************************************************
 
 static int
-rtap_rule_action_forward(struct rtap_rule* r, struct sk_buff *skb)
+rtap_rule_action_forward(struct rtap_rule* r, struct rtap_frame *frame)
 {
 
   if (!r || r->aid != ACTION_FWRD)
@@ -203,7 +219,7 @@ rtap_rule_action_forward(struct rtap_rule* r, struct sk_buff *skb)
     return (-1);
   }
 
-  listener_send(r->arg.l, skb);
+  listener_send(r->arg.l, frame);
 
   // Return NULL on success; negative on error
   return (0);
@@ -212,7 +228,7 @@ rtap_rule_action_forward(struct rtap_rule* r, struct sk_buff *skb)
 //*****************************************************************************
 
 static int
-rtap_rule_action_count(struct rtap_rule* r, struct sk_buff *skb)
+rtap_rule_action_count(struct rtap_rule* r, struct rtap_frame *frame)
 {
   if (!r || r->aid != ACTION_CNT)
   {
@@ -299,6 +315,12 @@ rtap_rule_set_action(rtap_rule_t* r, rtap_rule_action_t aid, void* arg)
   int ret = -1;
   if (r && aid)
   {
+    // Drop a listener bound by an earlier forward action
+    if ((r->aid == ACTION_FWRD) && r->arg.l)
+    {
+      listener_put(r->arg.l);
+      r->arg.l = NULL;
+    }
     r->aid = aid;
     switch (aid)
     {
@@ -312,7 +334,8 @@ rtap_rule_set_action(rtap_rule_t* r, rtap_rule_action_t aid, void* arg)
       break;
     case ACTION_FWRD:
       r->func = rtap_rule_action_forward;
-      r->arg.l = (void*) listener_findbyid(*(unsigned int*) arg);
+      // Held until the rule is destroyed, so removing the listener is safe
+      r->arg.l = (void*) listener_getbyid(*(unsigned int*) arg);
       if (r->arg.l)
       {
         ret = 0;
@@ -363,12 +386,12 @@ rtap_rule_findbyid(const rtap_rule_id_t rid)
  *
 ******************************************************************************/
 int
-rtap_rule_invoke(struct rtap_rule* r, struct sk_buff *skb)
+rtap_rule_invoke(struct rtap_rule* r, struct rtap_frame *frame)
 {
   int ret = -1;
   if (r && r->func)
   {
-    ret = r->func(r, skb);
+    ret = r->func(r, frame);
   }
   return(ret);
 }
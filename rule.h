@@ -42,6 +42,7 @@ typedef enum rtap_rule_action
 } rtap_rule_action_t;
 
 struct rtap_rule;
+struct rtap_frame;
 
 //*****************************************************************************
 // Global variables
@@ -69,6 +70,6 @@ extern struct rtap_rule*
 rtap_rule_findbyid(rtap_rule_id_t rid);
 
 extern int
-rtap_rule_invoke(struct rtap_rule* r, struct sk_buff *skb);
+rtap_rule_invoke(struct rtap_rule* r, struct rtap_frame *frame);
 
 #endif
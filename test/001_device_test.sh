@@ -10,10 +10,48 @@ echo "mon0" | sudo tee /proc/rtap/devices
 dmesg 
 cat /proc/rtap/devices
 
+echo "mon0 ring=1024 reserve=256,64,128" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
+echo "mon0 workers=2 cpus=0-1 budget=128 prefilter=1" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
+echo "mon0 workers=2 node=0 sched=fifo:10" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
+echo "mon0 attach=rxhandler consume=1" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
+echo "mon0 mode=inline" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
+echo "mon0 poll=50 pollrate=20000" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
+echo "mon0 mode=wq workers=2" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
 echo "-mon0" | sudo tee /proc/rtap/devices
 dmesg 
 cat /proc/rtap/devices
 
+echo "mon* workers=2" | sudo tee /proc/rtap/devices
+sudo iw dev mon1 del
+sudo iw phy phy0 interface add mon1 type monitor
+dmesg 
+cat /proc/rtap/devices
+
+echo "-mon*" | sudo tee /proc/rtap/devices
+dmesg 
+cat /proc/rtap/devices
+
 grep "" /proc/rtap/*
 
 
@@ -0,0 +1,35 @@
+sudo dmesg -c 
+sudo modprobe -r rtap
+make clean
+make
+sudo make install
+sudo modprobe rtap
+dmesg
+
+echo "1 127.0.0.1 8000" | sudo tee /proc/rtap/listeners 
+dmesg 
+cat /proc/rtap/listeners 
+
+echo "1 2 1" | sudo tee /proc/rtap/rules 
+dmesg 
+cat /proc/rtap/rules
+
+echo "mon0" | sudo tee /proc/rtap/devices
+dmesg
+cat /proc/rtap/devices
+
+# Classic BPF: radiotap header length (little endian) at offset 2, skip to
+# frame control and accept beacons only (tcpdump -ddd style, comma joined)
+echo "default 1 7 1 1 10,48 0 0 3,100 0 0 8,7 0 0 0,48 0 0 2,12 0 0 0,7 0 0 0,80 0 0 0,21 0 1 128,6 0 0 65535,6 0 0 0" | sudo tee /proc/rtap/filters
+dmesg
+cat /proc/rtap/filters 
+
+# Replay pre-recorded frames when a capture is given
+if [ -n "$1" ]; then
+    sudo tcpreplay -i mon0 "$1"
+fi
+sleep 5
+cat /proc/rtap/filters 
+
+grep "" /proc/rtap/*
+
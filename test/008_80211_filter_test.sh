@@ -0,0 +1,56 @@
+sudo dmesg -c 
+sudo modprobe -r rtap
+make clean
+make
+sudo make install
+sudo modprobe rtap
+dmesg
+
+echo "1 127.0.0.1 8000" | sudo tee /proc/rtap/listeners 
+dmesg 
+cat /proc/rtap/listeners 
+
+echo "1 2 1" | sudo tee /proc/rtap/rules 
+dmesg 
+cat /proc/rtap/rules
+
+echo "mon0" | sudo tee /proc/rtap/devices
+dmesg
+cat /proc/rtap/devices
+
+# Beacons by frame control, then anything sent by or to one station
+echo "default 1 3 1 5 0080" | sudo tee /proc/rtap/filters
+echo "default 2 3 1 3 f0:25:b7:00:b5:33" | sudo tee /proc/rtap/filters
+echo "default 3 3 1 4 f0:25:b7:00:b5:33" | sudo tee /proc/rtap/filters
+# Data frames of any subtype within one BSS
+echo "default 4 3 1 5 0008/000c" | sudo tee /proc/rtap/filters
+echo "default 5 3 1 6 f0:25:b7:00:b5:33" | sudo tee /proc/rtap/filters
+# Transmitter in a watchlist; the set can change under the filter
+echo "default 6 8 1 3 watch" | sudo tee /proc/rtap/filters
+echo "watch + f0:25:b7:00:b5:33 00:11:22:33:44:55" | sudo tee /proc/rtap/macsets
+echo "watch - 00:11:22:33:44:55" | sudo tee /proc/rtap/macsets
+# Any transmitter from one vendor or one MA-S block
+echo "default 7 9 1 3 vendors" | sudo tee /proc/rtap/filters
+echo "vendors + f0:25:b7/24 70:b3:d5:12:30/36" | sudo tee /proc/rtap/macsets
+cat /proc/rtap/macsets
+# Beacons and probes for a few networks, WPS or RSN advertisements
+echo "default 8 10 1 1 corp,guest*" | sudo tee /proc/rtap/filters
+echo "default 9 10 1 3 00:50:f2:04" | sudo tee /proc/rtap/filters
+echo "default 10 10 1 2 48" | sudo tee /proc/rtap/filters
+dmesg
+cat /proc/rtap/filters 
+
+# Replay pre-recorded frames when a capture is given
+if [ -n "$1" ]; then
+    sudo tcpreplay -i mon0 "$1"
+fi
+sleep 5
+cat /proc/rtap/filters 
+
+grep "" /proc/rtap/*
+
+
+# Removing the chain destroys its filters, their element tables and set refs
+echo "-default" | sudo tee /proc/rtap/filters
+dmesg
+cat /proc/rtap/filters 
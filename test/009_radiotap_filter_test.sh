@@ -0,0 +1,39 @@
+sudo dmesg -c 
+sudo modprobe -r rtap
+make clean
+make
+sudo make install
+sudo modprobe rtap
+dmesg
+
+echo "1 127.0.0.1 8000" | sudo tee /proc/rtap/listeners 
+dmesg 
+cat /proc/rtap/listeners 
+
+echo "1 2 1" | sudo tee /proc/rtap/rules 
+dmesg 
+cat /proc/rtap/rules
+
+echo "mon0" | sudo tee /proc/rtap/devices
+dmesg
+cat /proc/rtap/devices
+
+# Only usable frames: strong enough, 5 GHz, FCS good, HT MCS 0-7
+echo "default 1 2 1 1 -70" | sudo tee /proc/rtap/filters
+echo "default 2 2 1 3 5000 5900" | sudo tee /proc/rtap/filters
+echo "default 3 2 1 8 0" | sudo tee /proc/rtap/filters
+echo "default 4 2 1 6 0 7" | sudo tee /proc/rtap/filters
+# OFDM channels by flag
+echo "default 5 2 1 4 0040" | sudo tee /proc/rtap/filters
+dmesg
+cat /proc/rtap/filters 
+
+# Replay pre-recorded frames when a capture is given
+if [ -n "$1" ]; then
+    sudo tcpreplay -i mon0 "$1"
+fi
+sleep 5
+cat /proc/rtap/filters 
+
+grep "" /proc/rtap/*
+